@@ -6,6 +6,46 @@
 #include <chrono>      // 时间库
 #include <random>      // 随机数生成
 #include <algorithm>   // 算法函数
+#include <cstdint>     // 定长整数
+#include <cstdio>      // 文件读写
+#include <cstring>     // 内存拷贝
+#include <cstddef>     // offsetof
+#include <ctime>       // 会话时刻
+#include <cwchar>      // 宽字符串函数
+#include <type_traits> // 类型萃取
+#include <coroutine>   // 协程
+#include <initializer_list> // 初始化列表
+#include <thread>      // 线程
+#include <atomic>      // 原子变量
+#include <mutex>       // 互斥锁
+#include <memory>      // 智能指针
+#include <unordered_map> // 哈希表
+#include <string_view> // 字符串视图
+
+// x64 上 SSE2 总是可用
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h> // SSE2 指令
+#define SHAWARMA_SSE2 1
+#endif
+
+// x86 上用 rdtsc 取日志时间戳, 比系统时钟便宜得多
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define SHAWARMA_RDTSC 1
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define SHAWARMA_RDTSC 1
+#endif
+
+// 禁止内联与编译器内存屏障(基准测试用, 让被测调用留在循环内)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define SHAWARMA_NOINLINE __declspec(noinline)
+#define SHAWARMA_BARRIER() _ReadWriteBarrier()
+#else
+#define SHAWARMA_NOINLINE __attribute__((noinline))
+#define SHAWARMA_BARRIER() __asm__ __volatile__("" ::: "memory")
+#endif
 
 // 二维坐标结构体
 struct Vec2 { int x; int y; };
@@ -13,16 +53,432 @@ struct Vec2 { int x; int y; };
 // 颜色属性结构体
 struct Color { WORD attr; };
 
+// 日志格式编号 - 热路径只记录编号和整数参数, 文本在离线解码时才套用
+enum class LogFmt : uint16_t { 
+    DayStart, DayEnd, Action, Arrive, Serve, Lost, GrillIn, GrillOut, Upgrade, Rewind, FrameSlow, Bench, BranchSettle, Count 
+};
+
+// 与 LogFmt 一一对应的格式串, 参数均为 int32
+inline const char* logFormat(int id){ 
+    static const char* const formats[(int)LogFmt::Count] = { 
+        "day %d start, coins %d", 
+        "day %d end, revenue %d, served %d, lost %d", 
+        "frame %d key '%c'", 
+        "frame %d customer arrives, order kind %d, patience %d", 
+        "frame %d serve order kind %d, +%d coins, waited %d frames", 
+        "frame %d customer lost, order kind %d, waited %d frames", 
+        "frame %d grill slot %d in", 
+        "frame %d grill slot %d out", 
+        "upgrade %d bought, coins left %d", 
+        "rewind from frame %d to %d, restore %d us", 
+        "slow frame: %d ms", 
+        "bench %d", 
+        "branch %d day %d settled, +%d coins, served %d, lost %d", 
+    }; 
+    return id>=0 && id<(int)LogFmt::Count ? formats[id] : "?"; 
+}
+
+// 日志时间戳
+inline int64_t logTimestamp(){ 
+#ifdef SHAWARMA_RDTSC
+    return (int64_t)__rdtsc(); 
+#else
+    return std::chrono::steady_clock::now().time_since_epoch().count(); 
+#endif
+}
+
+// 日志时间戳每秒的计数, rdtsc 需要对照系统时钟校准一次
+inline int64_t logTicksPerSec(){ 
+#ifdef SHAWARMA_RDTSC
+    auto c0 = std::chrono::steady_clock::now(); 
+    int64_t t0 = logTimestamp(); 
+    std::this_thread::sleep_for(std::chrono::milliseconds(20)); 
+    int64_t t1 = logTimestamp(); 
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now()-c0).count(); 
+    return (int64_t)((t1-t0)/secs); 
+#else
+    using P=std::chrono::steady_clock::period; 
+    return (int64_t)(P::den/P::num); 
+#endif
+}
+
+// 定长二进制日志记录
+struct LogRecord { 
+    int64_t ts;        // 时间戳(logTimestamp)
+    uint16_t fmt;      // 格式编号
+    uint16_t thread;   // 线程编号
+    int32_t args[5];   // 参数
+};
+static_assert(sizeof(LogRecord)==32, "日志记录应为32字节");
+
+// 单生产者单消费者环形缓冲, 每个线程一个, 满时丢弃并计数
+struct LogRing { 
+    static constexpr uint32_t CAP = 1u<<14; 
+    alignas(64) std::atomic<uint64_t> head{0};     // 生产者写入位置
+    alignas(64) std::atomic<uint64_t> tail{0};     // 消费者读取位置
+    alignas(64) std::atomic<uint64_t> dropped{0};  // 丢弃条数
+    uint16_t id=0;                                 // 线程编号
+    LogRecord buf[CAP]; 
+    
+    void push(const LogRecord& r){ 
+        uint64_t h=head.load(std::memory_order_relaxed); 
+        if(h-tail.load(std::memory_order_acquire)>=CAP){ 
+            dropped.store(dropped.load(std::memory_order_relaxed)+1, std::memory_order_relaxed); 
+            return; 
+        } 
+        buf[h&(CAP-1)]=r; 
+        head.store(h+1, std::memory_order_release); 
+    } 
+};
+
+// 会话头 - 每次启动在日志末尾追加一条, 与日志记录同为32字节且 fmt 固定为 SESSION_FMT,
+// 文件因此始终是记录的序列, 之前的会话(包括崩溃的那次)不会被覆盖
+struct LogSessionHeader { 
+    int64_t startTime;    // 启动时刻(Unix秒)
+    uint16_t fmt;         // 固定为 SESSION_FMT, 与记录的格式编号区分
+    uint16_t version;     // 格式版本
+    uint32_t magic;       // 'SWLG'
+    int64_t ticksPerSec;  // 本次会话的时间戳频率
+    int64_t reserved; 
+};
+static_assert(sizeof(LogSessionHeader)==sizeof(LogRecord), "会话头应与日志记录等长");
+static_assert(offsetof(LogSessionHeader, fmt)==offsetof(LogRecord, fmt), "会话头的 fmt 应与记录对齐");
+
+// 延迟格式化的二进制日志 - 调用方只写本线程的环形缓冲, 后台线程定期收集并写文件
+struct Logger { 
+    static constexpr uint32_t MAGIC = 0x474C5753;  // "SWLG"
+    static constexpr uint16_t SESSION_FMT = 0xFFFF;  // 会话头的格式编号
+    static constexpr uint16_t VERSION = 2; 
+    static constexpr long MAX_BYTES = 64L<<20;      // 超过后轮转为 .1 文件再重新开始
+    
+    std::atomic<bool> enabled{false};          // 是否记录
+    std::mutex mu;                             // 保护 rings 的注册
+    std::vector<std::unique_ptr<LogRing>> rings; 
+    std::thread worker;                        // 后台写文件线程
+    std::atomic<bool> running{false}; 
+    FILE* file=nullptr; 
+    std::vector<LogRecord> batch;              // 后台线程的写出缓冲
+    
+    // 当前线程的环形缓冲(首次使用时注册)
+    LogRing* ring(){ 
+        thread_local LogRing* r=nullptr; 
+        if(!r){ 
+            std::lock_guard<std::mutex> lk(mu); 
+            rings.push_back(std::make_unique<LogRing>()); 
+            r=rings.back().get(); 
+            r->id=(uint16_t)(rings.size()-1); 
+        } 
+        return r; 
+    }
+    
+    template<class... A>
+    void log(LogFmt f, A... a){ 
+        static_assert(sizeof...(A)<=5, "最多5个参数"); 
+        if(!enabled.load(std::memory_order_relaxed)) return; 
+        LogRing* r=ring(); 
+        LogRecord rec; 
+        rec.ts=logTimestamp(); 
+        rec.fmt=(uint16_t)f; 
+        rec.thread=r->id; 
+        int32_t v[5]={(int32_t)a...}; 
+        std::memcpy(rec.args, v, sizeof(v)); 
+        r->push(rec); 
+    }
+    
+    // 收集所有环形缓冲并写入文件
+    void drain(){ 
+        batch.clear(); 
+        { 
+            std::lock_guard<std::mutex> lk(mu); 
+            for(auto& r: rings){ 
+                uint64_t t=r->tail.load(std::memory_order_relaxed); 
+                uint64_t h=r->head.load(std::memory_order_acquire); 
+                for(; t<h; t++) batch.push_back(r->buf[t&(LogRing::CAP-1)]); 
+                r->tail.store(h, std::memory_order_release); 
+            } 
+        } 
+        if(file && !batch.empty()){ 
+            std::fwrite(batch.data(), sizeof(LogRecord), batch.size(), file); 
+            std::fflush(file);  // 进程崩溃时已收集的记录不留在stdio缓冲里
+        } 
+    }
+    
+    // 打开日志并追加会话头, 之前会话的记录保留在文件中; 旧格式、过大或末尾残缺(崩溃时写了半条)的文件先轮转为 path.1
+    bool start(const char* path){ 
+        long size=0; 
+        bool reuse=false; 
+        if(FILE* old=std::fopen(path,"rb")){ 
+            LogSessionHeader first{}; 
+            reuse = std::fread(&first, sizeof(first), 1, old)==1 && first.fmt==SESSION_FMT && first.magic==MAGIC; 
+            std::fseek(old, 0, SEEK_END); 
+            size=std::ftell(old); 
+            std::fclose(old); 
+            if(!reuse || size>=MAX_BYTES || size%(long)sizeof(LogRecord)){ 
+                std::string prev=std::string(path)+".1"; 
+                std::remove(prev.c_str()); 
+                std::rename(path, prev.c_str()); 
+                reuse=false; 
+            } 
+        } 
+        file=std::fopen(path, reuse ? "ab" : "wb"); 
+        if(!file) return false; 
+        LogSessionHeader h{(int64_t)std::time(nullptr), SESSION_FMT, VERSION, MAGIC, logTicksPerSec(), 0}; 
+        std::fwrite(&h, sizeof(h), 1, file); 
+        std::fflush(file); 
+        running=true; 
+        enabled=true; 
+        worker=std::thread([this]{ 
+            while(running.load()){ 
+                drain(); 
+                std::this_thread::sleep_for(std::chrono::milliseconds(5)); 
+            } 
+            drain(); 
+        }); 
+        return true; 
+    }
+    
+    void stop(){ 
+        enabled=false; 
+        if(worker.joinable()){ 
+            running=false; 
+            worker.join(); 
+        } 
+        if(file){ 
+            std::fclose(file); 
+            file=nullptr; 
+        } 
+    }
+    
+    uint64_t dropped(){ 
+        std::lock_guard<std::mutex> lk(mu); 
+        uint64_t n=0; 
+        for(auto& r: rings) n+=r->dropped.load(std::memory_order_relaxed); 
+        return n; 
+    }
+    
+    ~Logger(){ stop(); }
+};
+
+inline Logger& logger(){ 
+    static Logger l; 
+    return l; 
+}
+
+// 调色板 - 后台缓冲区每格只存1字节的颜色编号, 呈现时才查表还原为控制台属性;
+// 宽字符的首/尾标记也算在属性里, 同一种颜色最多占三项, 游戏里实际只用到十几项
+struct Palette {
+    static constexpr int KEY_BITS=10;       // 只区分属性的低10位(前景/背景色 + 首/尾标记)
+    WORD attrs[256]={};                     // 编号 -> 属性
+    uint16_t index[1<<KEY_BITS];            // 属性 -> 编号, 0xFFFF为未分配
+    int count=0;                            // 已分配项数
+    
+    Palette(){ std::fill(std::begin(index), std::end(index), (uint16_t)0xFFFF); }
+    
+    // 属性对应的编号, 首次出现时分配; 用满256项后退回0号
+    uint8_t of(WORD attr){ 
+        uint16_t& i=index[attr&((1<<KEY_BITS)-1)]; 
+        if(i==0xFFFF){ 
+            if(count>=256) return 0; 
+            attrs[count]=attr; 
+            i=(uint16_t)count++; 
+        } 
+        return (uint8_t)i; 
+    }
+};
+
+inline Palette& palette(){ 
+    static Palette p; 
+    return p; 
+}
+
+// 单元格批量操作内核 - 字符平面每格2字节、颜色平面每格1字节, SSE2下字符每次8格、颜色每次16格
+inline void fillChars(uint16_t* d, int n, uint16_t ch){ 
+    int i=0; 
+#ifdef SHAWARMA_SSE2
+    __m128i v=_mm_set1_epi16((short)ch); 
+    for(; i+8<=n; i+=8) _mm_storeu_si128((__m128i*)(d+i), v); 
+#endif
+    for(; i<n; i++) d[i]=ch; 
+}
+
+// 按掩码拷贝n格字符: 掩码为0xFF的格取src, 为0的格保留dst(透明)
+inline void blitChars(uint16_t* d, const uint16_t* s, const uint8_t* mask, int n){ 
+    int i=0; 
+#ifdef SHAWARMA_SSE2
+    for(; i+8<=n; i+=8){ 
+        __m128i m=_mm_loadl_epi64((const __m128i*)(mask+i)); 
+        m=_mm_unpacklo_epi8(m,m);  // 每个掩码字节扩成16位
+        __m128i sv=_mm_loadu_si128((const __m128i*)(s+i)); 
+        __m128i dv=_mm_loadu_si128((const __m128i*)(d+i)); 
+        _mm_storeu_si128((__m128i*)(d+i), _mm_or_si128(_mm_and_si128(m,sv), _mm_andnot_si128(m,dv))); 
+    } 
+#endif
+    for(; i<n; i++) if(mask[i]) d[i]=s[i]; 
+}
+
+// 按掩码拷贝n格颜色
+inline void blitColors(uint8_t* d, const uint8_t* s, const uint8_t* mask, int n){ 
+    int i=0; 
+#ifdef SHAWARMA_SSE2
+    for(; i+16<=n; i+=16){ 
+        __m128i m=_mm_loadu_si128((const __m128i*)(mask+i)); 
+        __m128i sv=_mm_loadu_si128((const __m128i*)(s+i)); 
+        __m128i dv=_mm_loadu_si128((const __m128i*)(d+i)); 
+        _mm_storeu_si128((__m128i*)(d+i), _mm_or_si128(_mm_and_si128(m,sv), _mm_andnot_si128(m,dv))); 
+    } 
+#endif
+    for(; i<n; i++) if(mask[i]) d[i]=s[i]; 
+}
+
+// 把字符/颜色平面转换为控制台的 CHAR_INFO, 只在呈现时调用
+inline void toCharInfo(CHAR_INFO* dst, const uint16_t* chars, const uint8_t* colors, int n, const Palette& pal){ 
+    for(int i=0;i<n;i++){ 
+        dst[i].Char.UnicodeChar=(wchar_t)chars[i]; 
+        dst[i].Attributes=pal.attrs[colors[i]]; 
+    } 
+}
+
+// 精灵图集 - 预先构建好的ASCII画单元格块, 空格为透明
+struct SpriteAtlas {
+    struct Sprite { int w; int h; int offset; };  // 尺寸与在图集中的起始位置
+    std::vector<uint16_t> chars;   // 所有精灵的字符, 逐行连续存放
+    std::vector<uint8_t> colors;   // 对应的颜色编号
+    std::vector<uint8_t> mask;     // 对应的不透明掩码
+    std::vector<Sprite> sprites;   // 精灵表
+    
+    // 由若干行文本构建精灵, 返回编号
+    int add(std::initializer_list<const wchar_t*> rows, WORD attr){ 
+        Sprite sp{0,(int)rows.size(),(int)chars.size()}; 
+        uint8_t color=palette().of(attr); 
+        for(const wchar_t* row: rows) sp.w=std::max(sp.w,(int)std::wcslen(row)); 
+        for(const wchar_t* row: rows){ 
+            int len=(int)std::wcslen(row); 
+            for(int x=0;x<sp.w;x++){ 
+                wchar_t ch = x<len ? row[x] : L' '; 
+                chars.push_back((uint16_t)ch); 
+                colors.push_back(color); 
+                mask.push_back(ch==L' ' ? 0 : 0xFF); 
+            } 
+        } 
+        sprites.push_back(sp); 
+        return (int)sprites.size()-1; 
+    }
+};
+
+// 东亚宽字符(W/F)码位区间, 这些字符在终端里占两列
+struct WideRange { uint32_t lo; uint32_t hi; };
+constexpr WideRange WIDE_RANGES[] = { 
+    {0x1100,0x115F},{0x231A,0x231B},{0x2329,0x232A},{0x23E9,0x23EC},{0x23F0,0x23F0},{0x23F3,0x23F3}, 
+    {0x25FD,0x25FE},{0x2614,0x2615},{0x2648,0x2653},{0x267F,0x267F},{0x2693,0x2693},{0x26A1,0x26A1}, 
+    {0x26AA,0x26AB},{0x26BD,0x26BE},{0x26C4,0x26C5},{0x26CE,0x26CE},{0x26D4,0x26D4},{0x26EA,0x26EA}, 
+    {0x26F2,0x26F3},{0x26F5,0x26F5},{0x26FA,0x26FA},{0x26FD,0x26FD},{0x2705,0x2705},{0x270A,0x270B}, 
+    {0x2728,0x2728},{0x274C,0x274C},{0x274E,0x274E},{0x2753,0x2755},{0x2757,0x2757},{0x2795,0x2797}, 
+    {0x27B0,0x27B0},{0x27BF,0x27BF},{0x2B1B,0x2B1C},{0x2B50,0x2B50},{0x2B55,0x2B55},{0x2E80,0x2E99}, 
+    {0x2E9B,0x2EF3},{0x2F00,0x2FD5},{0x2FF0,0x2FFB},{0x3000,0x303E},{0x3041,0x3096},{0x3099,0x30FF}, 
+    {0x3105,0x312F},{0x3131,0x318E},{0x3190,0x31E3},{0x31F0,0x321E},{0x3220,0x3247},{0x3250,0x4DBF}, 
+    {0x4E00,0xA48C},{0xA490,0xA4C6},{0xA960,0xA97C},{0xAC00,0xD7A3},{0xF900,0xFAFF},{0xFE10,0xFE19}, 
+    {0xFE30,0xFE52},{0xFE54,0xFE66},{0xFE68,0xFE6B},{0xFF01,0xFF60},{0xFFE0,0xFFE6}, 
+};
+
+// BMP 宽字符位图(每码位1位, 共8KB), 编译期按64位字整块生成
+struct WidthTable { uint64_t bits[1024]; };
+constexpr WidthTable makeWidthTable(){ 
+    WidthTable t{}; 
+    for(const WideRange& r: WIDE_RANGES){ 
+        for(uint32_t w=r.lo>>6; w<=(r.hi>>6); w++){ 
+            uint32_t a=std::max(r.lo, w<<6), b=std::min(r.hi, (w<<6)+63); 
+            uint64_t m = b-a==63 ? ~0ull : ((1ull<<(b-a+1))-1) << (a&63); 
+            t.bits[w] |= m; 
+        } 
+    } 
+    return t; 
+}
+inline constexpr WidthTable WIDTH_TABLE = makeWidthTable();
+
+// 字符显示宽度(1或2列)
+constexpr int charWidth(wchar_t c){ 
+    uint32_t u=(uint32_t)c; 
+    return u<=0xFFFF && ((WIDTH_TABLE.bits[u>>6]>>(u&63))&1) ? 2 : 1; 
+}
+static_assert(charWidth(L'A')==1 && charWidth(L'库')==2 && charWidth(L'，')==2, "宽度表错误");
+
+// 排好的一段文本: 每格的字符与宽度标记(不含颜色)
+enum : uint8_t { CELL_NARROW, CELL_LEAD, CELL_TRAIL };
+struct TextRun { 
+    std::vector<uint16_t> chars; 
+    std::vector<uint8_t> kind; 
+    int size() const { return (int)chars.size(); }
+};
+
+// 把文本排成单元格: 宽字符占两格, 分别标为首/尾, 与控制台的双列显示一致
+inline void layoutText(std::wstring_view s, TextRun& out){ 
+    out.chars.clear(); 
+    out.kind.clear(); 
+    for(wchar_t ch: s){ 
+        if(charWidth(ch)==2){ 
+            out.chars.push_back((uint16_t)ch); 
+            out.chars.push_back((uint16_t)ch); 
+            out.kind.push_back(CELL_LEAD); 
+            out.kind.push_back(CELL_TRAIL); 
+        } else { 
+            out.chars.push_back((uint16_t)ch); 
+            out.kind.push_back(CELL_NARROW); 
+        } 
+    } 
+}
+
+// 文本排版缓存 - 固定标签按地址驻留为编号(命中时核对内容), 测量与排版只做一次
+struct TextCache { 
+    std::unordered_map<const wchar_t*, int> byPtr;   // 标签地址 -> 编号
+    std::unordered_map<std::wstring, int> byText;    // 文本内容 -> 编号(不同地址的相同文本共享)
+    std::vector<TextRun> layouts;                    // 编号 -> 排好的单元格
+    std::vector<const std::wstring*> sources;        // 编号 -> 原文(指向byText的键, 节点地址不变)
+    uint64_t hits=0;     // 命中次数
+    uint64_t misses=0;   // 未命中次数
+    
+    // 按地址快速查找, 命中后再核对内容: 地址被复用为其他文本(非字面量缓冲)时按内容重新绑定
+    const TextRun& get(const wchar_t* label){ 
+        auto it=byPtr.find(label); 
+        if(it!=byPtr.end() && std::wcscmp(sources[it->second]->c_str(), label)==0){ 
+            hits++; 
+            return layouts[it->second]; 
+        } 
+        misses++; 
+        auto t=byText.find(label); 
+        int id; 
+        if(t!=byText.end()) id=t->second; 
+        else { 
+            id=(int)layouts.size(); 
+            layouts.emplace_back(); 
+            layoutText(label, layouts.back()); 
+            t=byText.emplace(label, id).first; 
+            sources.push_back(&t->first); 
+        } 
+        byPtr[label]=id; 
+        return layouts[id]; 
+    }
+    
+    double hitRate() const { return hits+misses ? (double)hits/(hits+misses) : 0.0; }
+};
+
 // 渲染器类 - 负责控制台绘图
 struct Renderer {
     HANDLE hOut;                     // 控制台输出句柄
     int w;                           // 屏幕宽度
     int h;                           // 屏幕高度
-    std::vector<CHAR_INFO> back;     // 后台缓冲区
+    std::vector<uint16_t> chars;     // 后台缓冲区: 字符平面
+    std::vector<uint8_t> colors;     // 后台缓冲区: 颜色平面(调色板编号)
+    std::vector<uint16_t> shownChars;  // 上次呈现的内容, 用于逐行比较
+    std::vector<uint8_t> shownColors; 
+    bool shown=false;                // 是否已呈现过
+    std::vector<CHAR_INFO> staging;  // 呈现时的转换缓冲
     SMALL_RECT rect;                 // 控制台区域
+    TextCache text;                  // 标签排版缓存
+    TextRun scratch;                 // 动态文本的排版暂存
     
     // 构造函数 - 初始化控制台
-    Renderer(int width, int height) : hOut(GetStdHandle(STD_OUTPUT_HANDLE)), w(width), h(height), back(width*height) {
+    Renderer(int width, int height) : hOut(GetStdHandle(STD_OUTPUT_HANDLE)), w(width), h(height), 
+        chars(width*height), colors(width*height), shownChars(width*height), shownColors(width*height), staging(width*height) {
         rect = {0,0,(SHORT)(w-1),(SHORT)(h-1)};  // 设置控制台区域
         
         // 隐藏光标
@@ -37,59 +493,105 @@ struct Renderer {
         SetConsoleWindowInfo(hOut,TRUE,&rect);
     }
     
+    // 将一行中 [x, x+len) 裁剪到屏幕内, 返回是否还有可见部分; x和len被修改为裁剪后的值
+    bool clipSpan(int& x,int y,int& len) const {
+        if(y<0 || y>=h) return false; 
+        if(x<0){ len+=x; x=0; } 
+        if(x+len>w) len=w-x; 
+        return len>0; 
+    }
+    
+    // 填充一行中的一段
+    void fillSpan(int x,int y,int len, wchar_t ch, WORD attr){
+        if(!clipSpan(x,y,len)) return; 
+        fillChars(&chars[y*w+x], len, (uint16_t)ch); 
+        std::memset(&colors[y*w+x], palette().of(attr), len); 
+    }
+    
     // 清屏函数
     void clear(wchar_t ch, WORD attr){
-        for(int i=0;i<w*h;i++){ 
-            back[i].Char.UnicodeChar = ch; 
-            back[i].Attributes = attr; 
-        }
+        fillChars(chars.data(), w*h, (uint16_t)ch); 
+        std::memset(colors.data(), palette().of(attr), w*h); 
     }
     
-    // 绘制文本
-    void drawText(int x,int y,const std::wstring& s, WORD attr){
-        int idx = y*w + x;
-        for(size_t i=0;i<s.size();++i){ 
-            if(x+(int)i>=0 && x+(int)i<w && y>=0 && y<h){ 
-                back[idx+i].Char.UnicodeChar = s[i]; 
-                back[idx+i].Attributes = attr; 
-            } 
-        }
-        // 清空该行剩余部分
-        if(y>=0 && y<h){ 
-            for(int i=x+(int)s.size(); i<w; ++i){ 
-                int p=y*w+i; 
-                back[p].Char.UnicodeChar = L' '; 
-                back[p].Attributes = attr; 
-            } 
-        }
+    // 写入排好的单元格并加上颜色, 最多占 maxW 列(<0 表示到行尾), 返回结束列
+    int putCells(int x,int y,const TextRun& run, WORD attr, int maxW){
+        int n=run.size(); 
+        if(maxW>=0) n=std::min(n,maxW); 
+        int end=x+n, cx=x, len=n; 
+        if(!clipSpan(cx,y,len)) return end; 
+        int at=y*w+cx, from=cx-x; 
+        std::memcpy(&chars[at], run.chars.data()+from, len*sizeof(uint16_t)); 
+        Palette& pal=palette(); 
+        const uint8_t color[3]={pal.of(attr), pal.of(attr|COMMON_LVB_LEADING_BYTE), pal.of(attr|COMMON_LVB_TRAILING_BYTE)}; 
+        const uint8_t* kind=run.kind.data()+from; 
+        for(int i=0;i<len;++i) colors[at+i]=color[kind[i]]; 
+        // 被裁掉一半的宽字符显示为空格
+        if(kind[0]==CELL_TRAIL){ chars[at]=L' '; colors[at]=color[CELL_NARROW]; } 
+        if(kind[len-1]==CELL_LEAD){ chars[at+len-1]=L' '; colors[at+len-1]=color[CELL_NARROW]; } 
+        return end; 
+    }
+    
+    // 绘制动态文本(按字符宽度排版), 返回结束列
+    int drawText(int x,int y,std::wstring_view s, WORD attr, int maxW=-1){
+        layoutText(s, scratch); 
+        return putCells(x,y,scratch,attr,maxW); 
+    }
+    
+    // 绘制标签(通常为字面量), 排版结果按地址缓存并核对内容, 返回结束列
+    int drawLabel(int x,int y,const wchar_t* label, WORD attr, int maxW=-1){
+        return putCells(x,y,text.get(label),attr,maxW); 
+    }
+    
+    // 绘制"标签+数值"字段, 返回结束列
+    int drawField(int x,int y,const wchar_t* label,std::wstring_view value, WORD attr, int maxW=-1){
+        int cx=drawLabel(x,y,label,attr,maxW); 
+        return drawText(cx,y,value,attr,maxW<0?-1:std::max(0,maxW-(cx-x))); 
     }
     
     // 绘制矩形框
     void drawBox(int x,int y,int bw,int bh, WORD attr){
-        for(int yy=0; yy<bh; ++yy){ 
-            for(int xx=0; xx<bw; ++xx){ 
-                int p=(y+yy)*w+(x+xx); 
-                if(p>=0 && p<w*h){ 
-                    back[p].Char.UnicodeChar=L' '; 
-                    back[p].Attributes=attr; 
-                } 
-            } 
-        }
+        for(int yy=0; yy<bh; ++yy) fillSpan(x, y+yy, bw, L' ', attr); 
     }
     
     // 绘制进度条
     void drawBar(int x,int y,int bw,double ratio, WORD fillAttr, WORD emptyAttr){
         int fill = (int)std::clamp((int)(ratio*bw),0,bw);  // 计算填充长度
-        for(int i=0;i<bw;i++){ 
-            int p=y*w+(x+i); 
-            back[p].Char.UnicodeChar=L' '; 
-            back[p].Attributes = i<fill?fillAttr:emptyAttr;  // 根据位置选择颜色
+        fillSpan(x, y, fill, L' ', fillAttr); 
+        fillSpan(x+fill, y, bw-fill, L' ', emptyAttr); 
+    }
+    
+    // 绘制精灵, 透明格保留原有内容
+    void blit(const SpriteAtlas& atlas, int id, int x, int y){
+        const SpriteAtlas::Sprite& sp = atlas.sprites[id]; 
+        for(int row=0; row<sp.h; ++row){ 
+            int cx=x, len=sp.w; 
+            if(!clipSpan(cx, y+row, len)) continue; 
+            int src = sp.offset + row*sp.w + (cx-x), dst = (y+row)*w+cx; 
+            blitChars(&chars[dst], &atlas.chars[src], &atlas.mask[src], len); 
+            blitColors(&colors[dst], &atlas.colors[src], &atlas.mask[src], len); 
         }
     }
     
-    // 将后台缓冲区内容输出到控制台
+    // 将后台缓冲区内容输出到控制台: 逐行与上次呈现的内容比较, 只转换并写出变化的行段
     void present(){ 
-        WriteConsoleOutputW(hOut, back.data(), {(SHORT)w,(SHORT)h}, {0,0}, &rect); 
+        int y0=0, y1=h-1; 
+        if(shown){ 
+            auto same=[&](int y){ 
+                return std::memcmp(&chars[y*w], &shownChars[y*w], w*sizeof(uint16_t))==0 
+                    && std::memcmp(&colors[y*w], &shownColors[y*w], w)==0; 
+            }; 
+            while(y0<h && same(y0)) y0++; 
+            if(y0==h) return;  // 与上次完全相同
+            while(same(y1)) y1--; 
+        } 
+        int n=(y1-y0+1)*w; 
+        toCharInfo(staging.data(), &chars[y0*w], &colors[y0*w], n, palette()); 
+        SMALL_RECT region={0,(SHORT)y0,(SHORT)(w-1),(SHORT)y1}; 
+        WriteConsoleOutputW(hOut, staging.data(), {(SHORT)w,(SHORT)(y1-y0+1)}, {0,0}, &region); 
+        std::memcpy(&shownChars[y0*w], &chars[y0*w], n*sizeof(uint16_t)); 
+        std::memcpy(&shownColors[y0*w], &colors[y0*w], n); 
+        shown=true; 
     }
 };
 
@@ -120,18 +622,6 @@ struct Inventory {
 // 沙威玛状态枚举
 enum class ShawarmaState { Empty, Open, Wrapped, Grilling, Done };
 
-// 沙威玛结构体
-struct Shawarma {
-    ShawarmaState state=ShawarmaState::Empty;  // 当前状态
-    bool hasMeat=false;      // 是否有肉
-    bool hasCucumber=false;  // 是否有黄瓜
-    bool hasFries=false;     // 是否有薯条
-    bool hasKetchup=false;   // 是否有番茄酱
-    bool hasSauce=true;      // 是否有沙司
-    int grillTime=0;         // 已烤时间
-    int grillNeed=0;         // 需要烤的时间
-};
-
 // 订单项结构体
 struct OrderItem { 
     bool shawarma=false;  // 是否要沙威玛
@@ -140,12 +630,140 @@ struct OrderItem {
     bool noSauce=false;   // 是否不要沙司
 };
 
-// 顾客结构体
-struct Customer {
-    OrderItem want;       // 顾客需求
-    int patienceMax=100;  // 最大耐心值
-    int patience=100;     // 当前耐心值
-    bool served=false;    // 是否已服务
+// 卷饼所在工位: 操作台(摊开的面饼)、包装槽、烤盘
+enum class Station : uint8_t { Board, Pack, Grill };
+
+// 位置组件: 工位 + 槽号
+struct Place { 
+    Station station=Station::Board; 
+    uint8_t slot=0; 
+};
+
+// 食材组件的位标志
+enum : uint8_t { ING_MEAT=1, ING_CUCUMBER=2, ING_FRIES=4, ING_KETCHUP=8, ING_SAUCE=16 };
+
+// 烤制计时组件
+struct GrillTimer { 
+    int time=0;  // 已烤时间
+    int need=0;  // 需要烤的时间
+};
+
+// 卷饼实体存储 - 实体即下标, 各组件为独立的稠密数组, 系统只遍历用到的组件;
+// 换工位只改位置与状态组件; 删除时用末尾实体填洞, 并修正工位到实体的索引
+struct WrapStore {
+    static constexpr int SLOTS=3;            // 包装槽/烤盘位数
+    static constexpr int MAX=1+SLOTS*2;      // 同时存在的卷饼上限
+    std::vector<uint8_t> ingredients;        // 食材
+    std::vector<ShawarmaState> state;        // 状态
+    std::vector<Place> place;                // 位置
+    std::vector<GrillTimer> timer;           // 烤制计时
+    std::vector<int> readyAt;                // 放进包装槽(可上菜)的帧
+    int board=-1;                            // 操作台上的面饼, -1为空
+    int pack[SLOTS]={-1,-1,-1};              // 包装槽 -> 实体
+    int grill[SLOTS]={-1,-1,-1};             // 烤盘位 -> 实体
+    
+    int size() const { return (int)state.size(); }
+    
+    // 工位槽对应的实体
+    int& at(Place p){ return p.station==Station::Board ? board : (p.station==Station::Pack ? pack[p.slot] : grill[p.slot]); }
+    int at(Place p) const { return p.station==Station::Board ? board : (p.station==Station::Pack ? pack[p.slot] : grill[p.slot]); }
+    
+    // 工位槽上卷饼的状态, 空槽为Empty
+    ShawarmaState stateAt(Place p) const { int e=at(p); return e<0 ? ShawarmaState::Empty : state[e]; }
+    
+    // 在空槽上创建卷饼
+    int create(Place p, ShawarmaState st){ 
+        int e=size(); 
+        ingredients.push_back(0); 
+        state.push_back(st); 
+        place.push_back(p); 
+        timer.push_back(GrillTimer()); 
+        readyAt.push_back(0); 
+        at(p)=e; 
+        return e; 
+    }
+    
+    // 把卷饼移到另一个空槽
+    void move(int e, Place to, ShawarmaState st){ 
+        at(place[e])=-1; 
+        place[e]=to; 
+        state[e]=st; 
+        at(to)=e; 
+    }
+    
+    // 删除卷饼
+    void destroy(int e){ 
+        at(place[e])=-1; 
+        int last=size()-1; 
+        if(e!=last){ 
+            ingredients[e]=ingredients[last]; 
+            state[e]=state[last]; 
+            place[e]=place[last]; 
+            timer[e]=timer[last]; 
+            readyAt[e]=readyAt[last]; 
+            at(place[e])=e; 
+        } 
+        ingredients.pop_back(); 
+        state.pop_back(); 
+        place.pop_back(); 
+        timer.pop_back(); 
+        readyAt.pop_back(); 
+    }
+    
+    // 按位置组件重建工位索引
+    void reindex(){ 
+        board=-1; 
+        for(int i=0;i<SLOTS;i++) pack[i]=grill[i]=-1; 
+        for(int e=0;e<size();e++) at(place[e])=e; 
+    }
+};
+
+// 耐心组件
+struct Patience { 
+    int left=100;  // 当前耐心值
+    int max=100;   // 最大耐心值
+};
+
+// 顾客实体存储 - 按到店顺序排列; 订单(冷)与耐心(热)分开存放, 每秒的耐心更新只扫耐心数组
+struct CustomerStore {
+    std::vector<OrderItem> order;    // 订单
+    std::vector<Patience> patience;  // 耐心
+    std::vector<int> arrive;         // 到店帧(统计用)
+    std::vector<uint8_t> served;     // 是否已服务
+    
+    int size() const { return (int)order.size(); }
+    bool empty() const { return order.empty(); }
+    
+    void add(const OrderItem& o, int patienceMax, int frame){ 
+        order.push_back(o); 
+        patience.push_back(Patience{patienceMax, patienceMax}); 
+        arrive.push_back(frame); 
+        served.push_back(0); 
+    }
+    
+    // 移除最前面的n位顾客
+    void popFront(int n){ 
+        order.erase(order.begin(), order.begin()+n); 
+        patience.erase(patience.begin(), patience.begin()+n); 
+        arrive.erase(arrive.begin(), arrive.begin()+n); 
+        served.erase(served.begin(), served.begin()+n); 
+    }
+    
+    // 按已有数组整体载入
+    void assign(const OrderItem* o, const Patience* p, const int* a, const uint8_t* sv, int n){ 
+        order.assign(o, o+n); 
+        patience.assign(p, p+n); 
+        arrive.assign(a, a+n); 
+        served.assign(sv, sv+n); 
+    }
+};
+
+// 分店: 开店时定下的随机种子和升级, 之后与总店互不影响
+struct Branch { 
+    unsigned seed=0; 
+    bool upAutoMeat=false; 
+    bool upGoldPlate=false; 
+    bool upExpand=false; 
 };
 
 // 游戏状态结构体
@@ -156,12 +774,93 @@ struct GameState {
     bool upAutoMeat=false;   // 自动切肉升级
     bool upGoldPlate=false;  // 金盘子升级
     bool upExpand=false;     // 扩展店面升级
+    std::vector<Branch> branches;  // 已开的分店
+};
+
+// 升级价格
+constexpr int UPGRADE_PRICE = 50;
+
+// 购买升级, 已购买或金币不足时返回false
+inline bool buyUpgrade(GameState& gs, Upgrade u){ 
+    bool& owned = u==Upgrade::AutoMeat ? gs.upAutoMeat : (u==Upgrade::GoldPlate ? gs.upGoldPlate : gs.upExpand); 
+    if(owned || gs.coins<UPGRADE_PRICE) return false; 
+    gs.coins-=UPGRADE_PRICE; 
+    owned=true; 
+    if(u==Upgrade::ExpandStore) gs.capacity+=3;  // 店面扩展增加容量
+    logger().log(LogFmt::Upgrade, (int)u, gs.coins); 
+    return true; 
+}
+
+// 以当前时间作为随机种子
+inline unsigned clockSeed(){ 
+    return (unsigned)std::chrono::high_resolution_clock::now().time_since_epoch().count(); 
+}
+
+// 分店价格与上限
+constexpr int BRANCH_PRICE = 200; 
+constexpr int MAX_BRANCHES = 4; 
+
+// 开分店, 沿用总店当前的升级; 已达上限或金币不足时返回false
+inline bool buyBranch(GameState& gs){ 
+    if((int)gs.branches.size()>=MAX_BRANCHES || gs.coins<BRANCH_PRICE) return false; 
+    gs.coins-=BRANCH_PRICE; 
+    Branch b; 
+    b.seed=clockSeed()^(unsigned)(gs.branches.size()*0x9E3779B9u); 
+    b.upAutoMeat=gs.upAutoMeat; 
+    b.upGoldPlate=gs.upGoldPlate; 
+    b.upExpand=gs.upExpand; 
+    gs.branches.push_back(b); 
+    return true; 
+}
+
+// 分店实时数据
+struct BranchStats { 
+    int frame=0;      // 当天已过帧数
+    int dayTime=0;    // 剩余秒数
+    int coins=0;      // 当天收入
+    int served=0;     // 成交
+    int lost=0;       // 流失
+    int waiting=0;    // 店内顾客
+};
+
+// 无锁快照(序号锁): 唯一的写者是模拟该分店的工作线程, 读者读到序号不变的一份为止, 双方都不会阻塞
+struct StatsSnapshot { 
+    static constexpr int N = sizeof(BranchStats)/sizeof(int); 
+    std::atomic<uint32_t> seq{0}; 
+    std::atomic<int> fields[N]; 
+    
+    StatsSnapshot(){ for(auto& f: fields) f.store(0, std::memory_order_relaxed); }
+    
+    void publish(const BranchStats& st){ 
+        int v[N]; 
+        std::memcpy(v, &st, sizeof(v)); 
+        uint32_t q=seq.load(std::memory_order_relaxed); 
+        seq.store(q+1, std::memory_order_relaxed); 
+        std::atomic_thread_fence(std::memory_order_release); 
+        for(int i=0;i<N;i++) fields[i].store(v[i], std::memory_order_relaxed); 
+        seq.store(q+2, std::memory_order_release); 
+    }
+    
+    BranchStats read() const { 
+        int v[N]; 
+        while(true){ 
+            uint32_t q=seq.load(std::memory_order_acquire); 
+            if(q&1) continue;  // 正在写
+            for(int i=0;i<N;i++) v[i]=fields[i].load(std::memory_order_relaxed); 
+            std::atomic_thread_fence(std::memory_order_acquire); 
+            if(seq.load(std::memory_order_relaxed)==q) break; 
+        } 
+        BranchStats st; 
+        std::memcpy(&st, v, sizeof(v)); 
+        return st; 
+    }
 };
 
 // 随机数生成器类
 struct RNG { 
     std::mt19937 rng; 
-    RNG():rng((unsigned)std::chrono::high_resolution_clock::now().time_since_epoch().count()){} 
+    RNG():rng(clockSeed()){} 
+    explicit RNG(unsigned seed):rng(seed){} 
     int next(int a,int b){ 
         std::uniform_int_distribution<int> d(a,b); 
         return d(rng); 
@@ -197,113 +896,584 @@ struct Input {
     }
 };
 
+// 每秒帧数(游戏逻辑与统计均以帧为时间单位)
+constexpr int FPS = 24;
+
+// HDR风格直方图 - 每个二进制量级分16个子桶, 相对误差约6%, 记录O(1)
+struct Histogram {
+    static constexpr int SUB_BITS = 4;            // 子桶位数
+    static constexpr int SUB = 1<<SUB_BITS;       // 每个量级的子桶数
+    static constexpr int BUCKETS = (32-SUB_BITS+1)*SUB;
+    uint32_t counts[BUCKETS] = {};  // 各桶计数
+    uint32_t total=0;               // 样本数
+    uint64_t sum=0;                 // 样本总和
+    uint32_t maxV=0;                // 最大值
+
+    // 值 -> 桶下标
+    static int index(uint32_t v){
+        if(v<(uint32_t)SUB) return (int)v;
+        int msb=0;
+        while((v>>msb)>1) msb++;
+        int shift=msb-SUB_BITS;
+        return (shift+1)*SUB + (int)((v>>shift)&(SUB-1));
+    }
+    // 桶下标 -> 该桶最小值
+    static uint32_t lowerBound(int i){
+        if(i<SUB) return (uint32_t)i;
+        int shift=i/SUB-1;
+        return (uint32_t)(SUB + i%SUB) << shift;
+    }
+
+    void record(uint32_t v){
+        counts[index(v)]++;
+        total++;
+        sum+=v;
+        if(v>maxV) maxV=v;
+    }
+
+    // 百分位(p取0~100), 返回所在桶的上界
+    uint32_t percentile(int p) const {
+        if(total==0) return 0;
+        uint64_t target = ((uint64_t)total*p+99)/100;
+        if(target==0) target=1;
+        uint64_t acc=0;
+        for(int i=0;i<BUCKETS;i++){
+            acc+=counts[i];
+            if(acc>=target){
+                uint32_t hi = i+1<BUCKETS ? lowerBound(i+1)-1 : maxV;
+                return std::min(hi, maxV);
+            }
+        }
+        return maxV;
+    }
+
+    uint32_t mean() const { return total ? (uint32_t)(sum/total) : 0; }
+};
+
+// 订单类型(用于流失统计)
+enum class OrderKind : uint8_t { Plain, NoSauce, WithFries, WithCola, Count };
+
+inline OrderKind orderKind(const OrderItem& o){
+    if(o.fries) return OrderKind::WithFries;
+    if(o.cola) return OrderKind::WithCola;
+    return o.noSauce ? OrderKind::NoSauce : OrderKind::Plain;
+}
+
+inline const wchar_t* orderKindName(int k){
+    static const wchar_t* names[] = {L"饼",L"无沙司",L"薯条套餐",L"可乐套餐"};
+    return names[k];
+}
+
+// 单日统计
+struct DayStats {
+    int day=0;                    // 第几天
+    int frames=0;                 // 当天经过的帧数
+    int revenue=0;                // 当天收入
+    int bestSecond=0;             // 单秒最高收入
+    int served[(int)OrderKind::Count] = {};  // 各订单类型成交数
+    int lost[(int)OrderKind::Count] = {};    // 各订单类型流失数
+    Histogram wait;               // 顾客在队列中的等待时长(帧)
+    Histogram serve;              // 饼可上菜(且顾客已到店)到成交的时长(帧)
+    Histogram grillIdle;          // 烤盘位空闲时长(帧)
+
+    int servedTotal() const { int s=0; for(int v: served) s+=v; return s; }
+    int lostTotal() const { int s=0; for(int v: lost) s+=v; return s; }
+    double revenuePerSec() const { return frames ? revenue*(double)FPS/frames : 0.0; }
+};
+
+// 事件类型
+enum class EventType : uint8_t { Arrive, Serve, Lost, GrillIn, GrillOut };
+
+// 按列存放的单日事件缓冲 - 游戏中只做追加, 当天结束时整块写入日志
+struct EventColumns {
+    std::vector<uint32_t> frame;  // 事件发生帧
+    std::vector<uint8_t> type;    // 事件类型
+    std::vector<uint8_t> arg;     // 订单类型或烤盘位
+    std::vector<int32_t> value;   // 金额或时长
+
+    void push(int f, EventType t, int a, int v){
+        frame.push_back((uint32_t)f);
+        type.push_back((uint8_t)t);
+        arg.push_back((uint8_t)a);
+        value.push_back(v);
+    }
+    size_t size() const { return frame.size(); }
+    // 丢弃第n条之后的事件(回溯后从旧时间点继续时使用)
+    void truncate(size_t n){
+        if(n>=size()) return;
+        frame.resize(n); type.resize(n); arg.resize(n); value.resize(n);
+    }
+};
+
+// 事件日志块头, 其后依次为 frame/type/arg/value 四列, 每列按4字节对齐
+struct EventBlockHeader {
+    uint32_t magic;     // 'SWEV'
+    uint32_t version;   // 格式版本
+    uint32_t day;       // 第几天
+    uint32_t count;     // 事件数
+    uint32_t frames;    // 当天帧数
+    uint32_t bytes;     // 整块字节数(含块头)
+};
+
+// 全部历史的汇总
+struct HistorySummary {
+    int days=0;        // 记录天数
+    long long revenue=0;  // 总收入
+    int served=0;      // 总成交
+    int lost[(int)OrderKind::Count] = {};  // 各类型总流失
+};
+
+// 统计模块 - 保存上一天的统计, 追加事件日志并汇总历史
+struct Analytics {
+    static constexpr uint32_t MAGIC = 0x56455753;  // "SWEV"
+    static constexpr uint32_t VERSION = 1;
+    const char* path = "shawarma_events.bin";  // 事件日志文件
+
+    bool hasDay=false;        // 是否已有上一天数据
+    DayStats last;            // 上一天统计
+    HistorySummary history;   // 历史汇总
+
+    static uint32_t pad4(uint32_t n){ return (n+3)&~3u; }
+
+    // 追加一天的事件块
+    void append(const DayStats& s, const EventColumns& ev){
+        uint32_t n = (uint32_t)ev.size();
+        EventBlockHeader h{MAGIC, VERSION, (uint32_t)s.day, n, (uint32_t)s.frames, 0};
+        h.bytes = sizeof(h) + n*4 + pad4(n) + pad4(n) + n*4;
+        FILE* f = std::fopen(path, "ab");
+        if(!f) return;
+        static const uint8_t zeros[4] = {};
+        std::fwrite(&h, sizeof(h), 1, f);
+        std::fwrite(ev.frame.data(), 4, n, f);
+        std::fwrite(ev.type.data(), 1, n, f);
+        std::fwrite(zeros, 1, pad4(n)-n, f);
+        std::fwrite(ev.arg.data(), 1, n, f);
+        std::fwrite(zeros, 1, pad4(n)-n, f);
+        std::fwrite(ev.value.data(), 4, n, f);
+        std::fclose(f);
+    }
+
+    // 映射整个日志文件, 只读取需要的列进行汇总
+    void aggregate(){
+        history = HistorySummary();
+        HANDLE hf = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if(hf==INVALID_HANDLE_VALUE) return;
+        LARGE_INTEGER size{};
+        GetFileSizeEx(hf, &size);
+        if(size.QuadPart < (LONGLONG)sizeof(EventBlockHeader)){ CloseHandle(hf); return; }
+        HANDLE hm = CreateFileMappingA(hf, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        const uint8_t* base = hm ? (const uint8_t*)MapViewOfFile(hm, FILE_MAP_READ, 0, 0, 0) : nullptr;
+        if(base){
+            size_t total=(size_t)size.QuadPart, off=0;
+            while(off+sizeof(EventBlockHeader)<=total){
+                const EventBlockHeader* h = (const EventBlockHeader*)(base+off);
+                if(h->magic!=MAGIC || h->version!=VERSION || h->bytes<sizeof(EventBlockHeader) || off+h->bytes>total) break;
+                uint32_t n = h->count;
+                const uint8_t* types = base+off+sizeof(EventBlockHeader)+n*4;
+                const uint8_t* args = types+pad4(n);
+                const int32_t* values = (const int32_t*)(args+pad4(n));
+                for(uint32_t i=0;i<n;i++){
+                    if(types[i]==(uint8_t)EventType::Serve){
+                        history.served++;
+                        history.revenue += values[i];
+                    } else if(types[i]==(uint8_t)EventType::Lost && args[i]<(uint8_t)OrderKind::Count){
+                        history.lost[args[i]]++;
+                    }
+                }
+                history.days++;
+                off += h->bytes;
+            }
+            UnmapViewOfFile(base);
+        }
+        if(hm) CloseHandle(hm);
+        CloseHandle(hf);
+    }
+
+    // 当天结束: 保存统计, 写日志并重新汇总
+    void commitDay(const DayStats& s, const EventColumns& ev){
+        last = s;
+        hasDay = true;
+        append(s, ev);
+        aggregate();
+    }
+};
+
+// 帧数转为"秒.十分位"文本
+inline std::wstring fmtSec(uint32_t frames){
+    uint32_t tenths = frames*10/FPS;
+    return std::to_wstring(tenths/10)+L"."+std::to_wstring(tenths%10);
+}
+
+// 场景协程 - 由调度器在每帧恢复, 通过 co_await 等待下一帧/按键/定时器/子场景
+struct SceneTask {
+    // 等待类型
+    enum class Wait { Now, Frame, Key, Timer, Child };
+    
+    struct promise_type {
+        Wait wait=Wait::Now;                              // 当前等待的事件
+        std::chrono::steady_clock::time_point wakeAt{};   // 定时器唤醒时刻
+        
+        SceneTask get_return_object(){ return SceneTask{std::coroutine_handle<promise_type>::from_promise(*this)}; }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void(){}
+        void unhandled_exception(){ throw; }
+    };
+    
+    std::coroutine_handle<promise_type> h;
+    
+    explicit SceneTask(std::coroutine_handle<promise_type> hh):h(hh){}
+    SceneTask(SceneTask&& o) noexcept :h(o.h){ o.h=nullptr; }
+    SceneTask& operator=(SceneTask&& o) noexcept { std::swap(h,o.h); return *this; }
+    SceneTask(const SceneTask&)=delete;
+    ~SceneTask(){ if(h) h.destroy(); }  // 销毁协程帧, 连带释放场景内的局部对象
+};
+
+// 场景调度器 - 唯一的事件循环, 负责计时、输入与显示, 只唤醒场景栈顶
+struct Scheduler {
+    Renderer& r;                   // 渲染器引用
+    Input& in;                     // 输入引用
+    std::vector<SceneTask> stack;  // 场景栈
+    wchar_t key=0;                 // 本帧按键, 0表示无
+    
+    Scheduler(Renderer& rr, Input& ii):r(rr),in(ii){}
+    
+    using Handle = std::coroutine_handle<SceneTask::promise_type>;
+    
+    // 挂起当前场景并设置等待类型
+    struct Await {
+        Scheduler& s;
+        SceneTask::Wait wait;
+        int ms;
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(Handle h){ 
+            h.promise().wait=wait; 
+            if(wait==SceneTask::Wait::Timer) h.promise().wakeAt=std::chrono::steady_clock::now()+std::chrono::milliseconds(ms); 
+        }
+        wchar_t await_resume() const noexcept { return s.key; }
+    };
+    
+    // 等待下一帧, 返回该帧的按键(无按键为0)
+    Await frame(){ return {*this, SceneTask::Wait::Frame, 0}; }
+    // 等待下一次按键
+    Await keyPress(){ return {*this, SceneTask::Wait::Key, 0}; }
+    // 等待指定毫秒
+    Await sleep(int ms){ return {*this, SceneTask::Wait::Timer, ms}; }
+    
+    // 压入子场景, 当前场景挂起直到子场景结束
+    struct PushAwait {
+        Scheduler& s;
+        SceneTask child;
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(Handle h){ 
+            h.promise().wait=SceneTask::Wait::Child; 
+            s.stack.push_back(std::move(child)); 
+        }
+        void await_resume() const noexcept {}
+    };
+    PushAwait push(SceneTask child){ return {*this, std::move(child)}; }
+    
+    // 栈顶场景本帧是否应被唤醒
+    bool ready(const SceneTask::promise_type& p) const {
+        switch(p.wait){ 
+            case SceneTask::Wait::Now:
+            case SceneTask::Wait::Frame: return true; 
+            case SceneTask::Wait::Key: return key!=0; 
+            case SceneTask::Wait::Timer: return std::chrono::steady_clock::now()>=p.wakeAt; 
+            default: return false; 
+        }
+    }
+    
+    // 运行一帧: 唤醒栈顶; 若压入子场景则立即启动它, 若场景结束则出栈并继续其父场景
+    void step(){
+        while(!stack.empty()){ 
+            Handle h = stack.back().h; 
+            if(!ready(h.promise())) return; 
+            size_t depth = stack.size(); 
+            h.resume(); 
+            if(h.done()){ 
+                stack.pop_back(); 
+                key=0;  // 按键已被子场景消费
+                if(!stack.empty()) stack.back().h.promise().wait=SceneTask::Wait::Now; 
+                continue; 
+            } 
+            if(stack.size()>depth){ key=0; continue; } 
+            return; 
+        }
+    }
+    
+    // 主循环, 根场景结束时返回
+    void run(SceneTask root){
+        stack.push_back(std::move(root)); 
+        auto next = std::chrono::steady_clock::now(); 
+        while(!stack.empty()){ 
+            // 只在栈顶等待帧或按键时读取输入, 刚启动或定时等待的场景不会吞掉按键
+            SceneTask::Wait w = stack.back().h.promise().wait; 
+            wchar_t ch; 
+            key = (w==SceneTask::Wait::Frame||w==SceneTask::Wait::Key) && in.pollKey(ch) ? ch : 0; 
+            step(); 
+            r.present(); 
+            
+            // 固定帧率, 落后时不追帧
+            next += std::chrono::milliseconds(1000/FPS); 
+            auto now = std::chrono::steady_clock::now(); 
+            if(next>now) Sleep((DWORD)std::chrono::duration_cast<std::chrono::milliseconds>(next-now).count()); 
+            else { 
+                logger().log(LogFmt::FrameSlow, (int)std::chrono::duration_cast<std::chrono::milliseconds>(now-next).count()+1000/FPS); 
+                next=now; 
+            } 
+        }
+    }
+};
+
+struct SceneMain;
+
+struct Franchise;
+
 // 入口场景类
 struct SceneEntrance {
     GameState& gs;  // 游戏状态引用
     Renderer& r;    // 渲染器引用
-    Input& in;      // 输入引用
+    Analytics& an;  // 统计引用
+    Franchise& fr;  // 分店经营引用
+    std::wstring info;  // 提示信息
     
-    bool wantStart=false;    // 是否想开始新游戏
-    bool wantUpgrade=false;  // 是否想升级
-    
-    SceneEntrance(GameState& g, Renderer& rr, Input& ii):gs(g),r(rr),in(ii){}
+    SceneEntrance(GameState& g, Renderer& rr, Analytics& aa, Franchise& ff):gs(g),r(rr),an(aa),fr(ff){}
     
     // 绘制入口界面
     void draw(){ 
         r.clear(L' ', FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED); 
-        r.drawText(2,2,L"入口界面", FOREGROUND_GREEN|FOREGROUND_INTENSITY); 
-        r.drawText(2,4,L"已玩局数: "+std::to_wstring(gs.day), FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED); 
-        r.drawText(2,5,L"累计金币: "+std::to_wstring(gs.coins), FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED); 
-        r.drawText(2,7,L"N 开启新的一天", FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED); 
-        r.drawText(2,8,L"U 店铺升级", FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED); 
-        r.drawText(2,10,L"Q 退出", FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED); 
-        r.present(); 
-    }
-    
-    // 入口界面主循环
-    void loop(){ 
-        wchar_t ch; 
-        while(true){ 
-            draw(); 
-            if(in.pollKey(ch)){ 
-                if(ch==L'N'||ch==L'n'){ 
-                    wantStart=true; 
-                    break; 
-                } 
-                if(ch==L'U'||ch==L'u'){ 
-                    wantUpgrade=true; 
-                    upgradeMenu(); 
-                } 
-                if(ch==L'Q'||ch==L'q'){ 
-                    ExitProcess(0);  // 退出程序
-                } 
-            } 
-            Sleep(1000/24);  // 约24帧/秒
-        }
+        r.drawLabel(2,2,L"入口界面", FOREGROUND_GREEN|FOREGROUND_INTENSITY); 
+        r.drawField(2,4,L"已玩局数: ",std::to_wstring(gs.day), FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED); 
+        r.drawField(2,5,L"累计金币: ",std::to_wstring(gs.coins), FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED); 
+        r.drawLabel(2,7,L"N 开启新的一天", FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED); 
+        r.drawLabel(2,8,L"U 店铺升级", FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED); 
+        r.drawLabel(2,10,L"Q 退出", FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED); 
+        r.drawText(2,24,info, FOREGROUND_GREEN|FOREGROUND_INTENSITY); 
+        drawStats(); 
+        drawBranches(); 
+    }
+    
+    // 绘制分店实时数据(定义在Franchise之后)
+    void drawBranches();
+    
+    // 绘制上一天统计与历史汇总
+    void drawStats(){ 
+        WORD attr = FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED; 
+        if(an.hasDay){ 
+            const DayStats& s = an.last; 
+            r.drawText(2,12,L"第"+std::to_wstring(s.day)+L"天统计", FOREGROUND_GREEN|FOREGROUND_INTENSITY); 
+            int x=r.drawField(2,13,L"收入: ",std::to_wstring(s.revenue), attr); 
+            x=r.drawField(x,13,L"  每秒: ",std::to_wstring((int)s.revenuePerSec()), attr); 
+            r.drawField(x,13,L"  单秒最高: ",std::to_wstring(s.bestSecond), attr); 
+            x=r.drawField(2,14,L"成交: ",std::to_wstring(s.servedTotal()), attr); 
+            r.drawField(x,14,L"  流失: ",std::to_wstring(s.lostTotal()), attr); 
+            r.drawField(2,15,L"等待(秒) p50/p90/p99: ",fmtSec(s.wait.percentile(50))+L"/"+fmtSec(s.wait.percentile(90))+L"/"+fmtSec(s.wait.percentile(99)), attr); 
+            r.drawField(2,16,L"出餐(秒) p50/p90/p99: ",fmtSec(s.serve.percentile(50))+L"/"+fmtSec(s.serve.percentile(90))+L"/"+fmtSec(s.serve.percentile(99)), attr); 
+            r.drawField(2,17,L"烤盘空闲(秒) p50/p90/最大: ",fmtSec(s.grillIdle.percentile(50))+L"/"+fmtSec(s.grillIdle.percentile(90))+L"/"+fmtSec(s.grillIdle.maxV), attr); 
+            x=r.drawLabel(2,18,L"流失分类:", attr); 
+            for(int k=0;k<(int)OrderKind::Count;k++) x=r.drawField(x+1,18,orderKindName(k),L" "+std::to_wstring(s.lost[k]), attr); 
+        } 
+        if(an.history.days>0){ 
+            const HistorySummary& h = an.history; 
+            int x=r.drawField(2,20,L"历史 ",std::to_wstring(h.days), attr); 
+            x=r.drawField(x,20,L" 天: 收入 ",std::to_wstring(h.revenue), attr); 
+            r.drawField(x,20,L"  成交 ",std::to_wstring(h.served), attr); 
+            x=r.drawLabel(2,21,L"历史流失:", attr); 
+            for(int k=0;k<(int)OrderKind::Count;k++) x=r.drawField(x+1,21,orderKindName(k),L" "+std::to_wstring(h.lost[k]), attr); 
+        } 
     }
     
+    // 入口界面主循环(定义在SceneMain之后)
+    SceneTask loop(Scheduler& s);
+    
     // 升级菜单
-    void upgradeMenu(){ 
+    SceneTask upgradeMenu(Scheduler& s){ 
         while(true){ 
             r.clear(L' ', FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED); 
-            r.drawText(2,2,L"店铺升级", FOREGROUND_GREEN|FOREGROUND_INTENSITY); 
-            r.drawText(2,4,L"A 自动切肉机 价格: 50 "+std::wstring(gs.upAutoMeat?L"[已购]":L""), FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED); 
-            r.drawText(2,5,L"G 金盘子(饼价值+20%) 价格: 50 "+std::wstring(gs.upGoldPlate?L"[已购]":L""), FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED); 
-            r.drawText(2,6,L"E 扩充店面(容量+3) 价格: 50 "+std::wstring(gs.upExpand?L"[已购]":L""), FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED); 
-            r.drawText(2,8,L"B 返回", FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED); 
-            r.drawText(2,10,L"当前金币: "+std::to_wstring(gs.coins), FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED); 
-            r.present(); 
+            r.drawLabel(2,2,L"店铺升级", FOREGROUND_GREEN|FOREGROUND_INTENSITY); 
+            r.drawField(2,4,L"A 自动切肉机 价格: 50 ",gs.upAutoMeat?L"[已购]":L"", FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED); 
+            r.drawField(2,5,L"G 金盘子(饼价值+20%) 价格: 50 ",gs.upGoldPlate?L"[已购]":L"", FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED); 
+            r.drawField(2,6,L"E 扩充店面(容量+3) 价格: 50 ",gs.upExpand?L"[已购]":L"", FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED); 
+            int x=r.drawField(2,7,L"K 开分店(沿用当前升级) 价格: 200 ",std::to_wstring(gs.branches.size()), FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED); 
+            r.drawField(x,7,L"/",std::to_wstring(MAX_BRANCHES), FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED); 
+            r.drawLabel(2,8,L"B 返回", FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED); 
+            r.drawField(2,10,L"当前金币: ",std::to_wstring(gs.coins), FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED); 
             
-            wchar_t ch; 
-            if(Input().pollKey(ch)){ 
-                if(ch==L'B'||ch==L'b') break;  // 返回
-                
-                // 购买自动切肉机
-                if(ch==L'A'||ch==L'a'){ 
-                    if(!gs.upAutoMeat && gs.coins>=50){ 
-                        gs.coins-=50; 
-                        gs.upAutoMeat=true; 
-                    } 
-                } 
-                // 购买金盘子
-                if(ch==L'G'||ch==L'g'){ 
-                    if(!gs.upGoldPlate && gs.coins>=50){ 
-                        gs.coins-=50; 
-                        gs.upGoldPlate=true; 
-                    } 
-                } 
-                // 购买店面扩展
-                if(ch==L'E'||ch==L'e'){ 
-                    if(!gs.upExpand && gs.coins>=50){ 
-                        gs.coins-=50; 
-                        gs.upExpand=true; 
-                        gs.capacity+=3; 
-                    } 
-                } 
-            } 
-            Sleep(1000/24); 
+            wchar_t ch = co_await s.keyPress(); 
+            if(ch==L'B'||ch==L'b') co_return;  // 返回
+            
+            // 购买自动切肉机
+            if(ch==L'A'||ch==L'a') buyUpgrade(gs, Upgrade::AutoMeat); 
+            // 购买金盘子
+            if(ch==L'G'||ch==L'g') buyUpgrade(gs, Upgrade::GoldPlate); 
+            // 购买店面扩展
+            if(ch==L'E'||ch==L'e') buyUpgrade(gs, Upgrade::ExpandStore); 
+            // 开分店
+            if(ch==L'K'||ch==L'k') buyBranch(gs); 
         }
     }
 };
 
-// 主游戏场景类
-struct SceneMain {
+// 回溯环形缓冲 - 按帧保存定长状态快照
+// 每组以一个完整关键帧开头, 组内其余帧只保存与关键帧按字节异或后的零游程编码,
+// 恢复任意帧 = 拷贝关键帧 + 应用一次差分. 缓冲满时整组淘汰, 内存有上界且稳定后不再分配
+struct RewindRing {
+    // 差分帧: 重复的 [uint16 跳过字节数][uint16 字面字节数][字面字节...]
+    struct Group {
+        int firstTick=0;                           // 关键帧对应的帧号
+        std::vector<uint8_t> key;                  // 关键帧原始字节
+        std::vector<std::vector<uint8_t>> deltas;  // 后续各帧的差分
+        int count=0;                               // 组内有效帧数(含关键帧)
+    };
+    
+    size_t stateSize;          // 快照字节数
+    int groupLen;              // 每组帧数
+    std::vector<Group> groups; // 组的环形数组
+    int oldest=0;              // 最旧组下标
+    int used=0;                // 已用组数
+    
+    RewindRing(size_t bytes, int groupFrames, int maxGroups):stateSize(bytes),groupLen(groupFrames),groups(maxGroups){
+        for(auto& g: groups){ 
+            g.key.resize(stateSize); 
+            g.deltas.resize(groupLen-1); 
+        }
+    }
+    
+    bool empty() const { return used==0; }
+    Group& at(int i){ return groups[(oldest+i)%(int)groups.size()]; }
+    const Group& at(int i) const { return groups[(oldest+i)%(int)groups.size()]; }
+    int oldestTick() const { return used ? at(0).firstTick : 0; }
+    int newestTick() const { return used ? at(used-1).firstTick + at(used-1).count - 1 : -1; }
+    
+    // 追加一帧(帧号必须紧接上一帧)
+    void push(int tick, const void* state){
+        if(used==0 || at(used-1).count==groupLen){ 
+            if(used==(int)groups.size()){ 
+                oldest=(oldest+1)%(int)groups.size();  // 淘汰最旧一组
+                used--; 
+            } 
+            Group& g = at(used++); 
+            g.firstTick=tick; 
+            g.count=1; 
+            std::memcpy(g.key.data(), state, stateSize); 
+            return; 
+        } 
+        Group& g = at(used-1); 
+        encode(g.key.data(), (const uint8_t*)state, g.deltas[g.count-1]); 
+        g.count++; 
+    }
+    
+    // 恢复指定帧, 帧不在缓冲内时返回false
+    bool restore(int tick, void* out) const {
+        if(tick<oldestTick() || tick>newestTick()) return false; 
+        int off = tick-oldestTick(); 
+        const Group& g = at(off/groupLen); 
+        int i = off%groupLen; 
+        std::memcpy(out, g.key.data(), stateSize); 
+        if(i>0) apply(g.deltas[i-1], (uint8_t*)out); 
+        return true; 
+    }
+    
+    // 丢弃指定帧之后的所有帧
+    void truncate(int tick){
+        while(used>0 && at(used-1).firstTick>tick) used--; 
+        if(used>0) at(used-1).count = std::min(at(used-1).count, tick-at(used-1).firstTick+1); 
+    }
+    
+    // 当前实际占用的字节数
+    size_t memoryBytes() const {
+        size_t n = groups.size()*sizeof(Group); 
+        for(auto& g: groups){ 
+            n += g.key.capacity(); 
+            for(auto& d: g.deltas) n += d.capacity() + sizeof(d); 
+        } 
+        return n; 
+    }
+    
+    // 异或差分 + 零游程编码
+    void encode(const uint8_t* base, const uint8_t* cur, std::vector<uint8_t>& out) const {
+        out.clear(); 
+        size_t i=0, n=stateSize; 
+        while(i<n){ 
+            size_t z=i; 
+            while(z<n && z-i<0xFFFF && base[z]==cur[z]) z++; 
+            if(z==n) break; 
+            size_t e=z; 
+            // 字面段遇到连续4个相同字节才结束, 避免过碎的段头
+            while(e<n && e-z<0xFFFF){ 
+                size_t same=0; 
+                while(same<4 && e+same<n && base[e+same]==cur[e+same]) same++; 
+                if(same==4 || e+same==n) break; 
+                e+=same+1; 
+            } 
+            uint16_t hdr[2] = {(uint16_t)(z-i), (uint16_t)(e-z)}; 
+            out.insert(out.end(), (const uint8_t*)hdr, (const uint8_t*)hdr+4); 
+            for(size_t k=z;k<e;k++) out.push_back(base[k]^cur[k]); 
+            i=e; 
+        } 
+    }
+    
+    static void apply(const std::vector<uint8_t>& d, uint8_t* state){
+        size_t pos=0, p=0; 
+        while(p+4<=d.size()){ 
+            uint16_t hdr[2]; 
+            std::memcpy(hdr, d.data()+p, 4); 
+            p+=4; 
+            pos+=hdr[0]; 
+            for(uint16_t k=0;k<hdr[1];k++) state[pos++]^=d[p++]; 
+        } 
+    }
+};
+
+// 厨房精灵 - 首次使用时构建一次
+struct KitchenSprites {
+    SpriteAtlas atlas; 
+    int customer[3];   // 顾客(耐心 高/中/低)
+    int wrapRaw;       // 已卷未烤
+    int wrapDone;      // 已烤好
+    int grillEmpty;    // 空烤位
+    int grillCooking;  // 烤制中
+    int grillDone;     // 烤好待取
+    
+    KitchenSprites(){ 
+        customer[0] = atlas.add({L" (^_^) ", L" /|_|\\ ", L"  / \\  "}, FOREGROUND_GREEN|FOREGROUND_INTENSITY); 
+        customer[1] = atlas.add({L" (-_-) ", L" /|_|\\ ", L"  / \\  "}, FOREGROUND_RED|FOREGROUND_GREEN|FOREGROUND_INTENSITY); 
+        customer[2] = atlas.add({L" (>_<) ", L" /|_|\\ ", L"  / \\  "}, FOREGROUND_RED|FOREGROUND_INTENSITY); 
+        wrapRaw  = atlas.add({L"  ___  ", L" (===) "}, FOREGROUND_RED|FOREGROUND_GREEN|FOREGROUND_BLUE); 
+        wrapDone = atlas.add({L"  ___  ", L" (###) "}, FOREGROUND_RED|FOREGROUND_GREEN); 
+        grillEmpty   = atlas.add({L"       ", L"[_____]", L" |   | "}, FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED); 
+        grillCooking = atlas.add({L" ~ ~ ~ ", L"[=###=]", L" |   | "}, FOREGROUND_RED|FOREGROUND_INTENSITY); 
+        grillDone    = atlas.add({L"  * *  ", L"[=###=]", L" |   | "}, FOREGROUND_RED|FOREGROUND_GREEN|FOREGROUND_INTENSITY); 
+    }
+};
+
+inline const KitchenSprites& kitchenSprites(){ 
+    static KitchenSprites k; 
+    return k; 
+}
+
+// 店铺模拟 - 库存、顾客、烤盘及全部操作逻辑, 不依赖渲染和输入, 可以无界面运行
+struct Shop {
     GameState& gs;   // 游戏状态引用
-    Renderer& r;     // 渲染器引用
-    Input& in;       // 输入引用
     Inventory inv;   // 库存
     RNG rng;         // 随机数生成器
     
-    Shawarma open;                       // 正在制作的面饼
-    std::deque<Shawarma> packaged;       // 包装好的沙威玛队列
-    std::deque<Shawarma> grilling;       // 正在烤制的沙威玛队列
-    std::deque<Customer> customers;      // 顾客队列
+    WrapStore wraps;             // 卷饼(操作台、包装槽、烤盘)
+    CustomerStore customers;     // 顾客队列
     
     int dayTimeMax=120;   // 每天最大时间
     int dayTime=120;      // 当前剩余时间
     int secCounter=0;     // 秒计数器
+    int frame=0;          // 当天已过帧数
     std::wstring msg;     // 消息文本
     
+    DayStats stats;           // 当天统计
+    EventColumns events;      // 当天事件
+    int secRevenue=0;         // 本秒收入
+    int grillIdleSince[3]={}; // 各烤盘位开始空闲的帧
+    size_t eventsAtLoad=0;    // 最近一次载入快照时的事件数
+    
     // 准备食物状态结构体
     struct Prep { 
         bool taken=false;  // 是否已拿容器
@@ -312,18 +1482,104 @@ struct SceneMain {
     Prep friesPrep;  // 薯条准备状态
     Prep colaPrep;   // 可乐准备状态
     
-    SceneMain(GameState& g, Renderer& rr, Input& ii):gs(g),r(rr),in(ii){ 
-        packaged.resize(3);  // 初始化包装槽
-        grilling.resize(3);  // 初始化烤盘槽
+    int supplyCycle=0;  // 补货循环索引
+    int ingCycle=0;     // 食材循环索引
+    bool logging=true;  // 是否写日志(后台分店关闭)
+    
+    // 模拟状态快照(定长可平凡拷贝, 供回溯缓冲按字节差分)
+    static constexpr int MAX_CUSTOMERS=16;
+    struct SimFrame {
+        Inventory inv; 
+        uint8_t wrapIngredients[WrapStore::MAX]; 
+        ShawarmaState wrapState[WrapStore::MAX]; 
+        Place wrapPlace[WrapStore::MAX]; 
+        GrillTimer wrapTimer[WrapStore::MAX]; 
+        int wrapReadyAt[WrapStore::MAX]; 
+        int wrapCount; 
+        OrderItem order[MAX_CUSTOMERS]; 
+        Patience patience[MAX_CUSTOMERS]; 
+        int arrive[MAX_CUSTOMERS]; 
+        uint8_t served[MAX_CUSTOMERS]; 
+        int customerCount; 
+        Prep friesPrep, colaPrep; 
+        int dayTime, secCounter, frame, supplyCycle, ingCycle, coins; 
+        std::mt19937 rng; 
+        DayStats stats;            // 统计随模拟一起回溯, 保证与金币一致
+        int secRevenue; 
+        int grillIdleSince[3]; 
+        uint32_t eventCount;       // 事件缓冲只追加, 记下长度即可回滚
+    };
+    static_assert(std::is_trivially_copyable<SimFrame>::value, "快照必须可按字节拷贝");
+    
+    Shop(GameState& g, unsigned seed):gs(g),rng(seed){}
+    
+    // 保存当前模拟状态
+    void capture(SimFrame& f){ 
+        std::memset((void*)&f, 0, sizeof(f)); 
+        f.inv=inv; 
+        f.wrapCount=wraps.size(); 
+        std::copy(wraps.ingredients.begin(), wraps.ingredients.end(), f.wrapIngredients); 
+        std::copy(wraps.state.begin(), wraps.state.end(), f.wrapState); 
+        std::copy(wraps.place.begin(), wraps.place.end(), f.wrapPlace); 
+        std::copy(wraps.timer.begin(), wraps.timer.end(), f.wrapTimer); 
+        std::copy(wraps.readyAt.begin(), wraps.readyAt.end(), f.wrapReadyAt); 
+        int n=f.customerCount=std::min(customers.size(), MAX_CUSTOMERS); 
+        std::copy(customers.order.begin(), customers.order.begin()+n, f.order); 
+        std::copy(customers.patience.begin(), customers.patience.begin()+n, f.patience); 
+        std::copy(customers.arrive.begin(), customers.arrive.begin()+n, f.arrive); 
+        std::copy(customers.served.begin(), customers.served.begin()+n, f.served); 
+        f.friesPrep=friesPrep; 
+        f.colaPrep=colaPrep; 
+        f.dayTime=dayTime; 
+        f.secCounter=secCounter; 
+        f.frame=frame; 
+        f.supplyCycle=supplyCycle; 
+        f.ingCycle=ingCycle; 
+        f.coins=gs.coins; 
+        f.rng=rng.rng; 
+        f.stats=stats; 
+        f.secRevenue=secRevenue; 
+        std::copy(grillIdleSince, grillIdleSince+3, f.grillIdleSince); 
+        f.eventCount=(uint32_t)events.size(); 
     }
     
+    // 载入模拟状态
+    void load(const SimFrame& f){ 
+        inv=f.inv; 
+        int n=f.wrapCount; 
+        wraps.ingredients.assign(f.wrapIngredients, f.wrapIngredients+n); 
+        wraps.state.assign(f.wrapState, f.wrapState+n); 
+        wraps.place.assign(f.wrapPlace, f.wrapPlace+n); 
+        wraps.timer.assign(f.wrapTimer, f.wrapTimer+n); 
+        wraps.readyAt.assign(f.wrapReadyAt, f.wrapReadyAt+n); 
+        wraps.reindex(); 
+        customers.assign(f.order, f.patience, f.arrive, f.served, f.customerCount); 
+        friesPrep=f.friesPrep; 
+        colaPrep=f.colaPrep; 
+        dayTime=f.dayTime; 
+        secCounter=f.secCounter; 
+        frame=f.frame; 
+        supplyCycle=f.supplyCycle; 
+        ingCycle=f.ingCycle; 
+        gs.coins=f.coins; 
+        rng.rng=f.rng; 
+        stats=f.stats; 
+        secRevenue=f.secRevenue; 
+        std::copy(f.grillIdleSince, f.grillIdleSince+3, grillIdleSince); 
+        eventsAtLoad=f.eventCount;  // 事件在确定从此继续时才截断, 以便查看中仍可前进
+    }
+    
+    // 写一条日志
+    template<class... A>
+    void note(LogFmt f, A... a){ if(logging) logger().log(f, a...); }
+    
     // 计算沙威玛价格
-    int priceShawarma(const Shawarma& s){ 
+    int priceShawarma(uint8_t ing){ 
         int base=20;  // 基础价格
-        if(s.hasCucumber) base+=3; 
-        if(s.hasKetchup) base+=2; 
-        if(s.hasFries) base+=8; 
-        if(s.hasMeat) base+=10; 
+        if(ing&ING_CUCUMBER) base+=3; 
+        if(ing&ING_KETCHUP) base+=2; 
+        if(ing&ING_FRIES) base+=8; 
+        if(ing&ING_MEAT) base+=10; 
         if(gs.upGoldPlate) base = base + base*20/100;  // 金盘子加成
         return base; 
     }
@@ -335,140 +1591,40 @@ struct SceneMain {
     
     // 生成顾客
     void spawnCustomer(){ 
-        if((int)customers.size()>=gs.capacity) return; 
+        if(customers.size()>=gs.capacity) return; 
         
-        Customer c; 
+        OrderItem want; 
         int t=rng.next(0,3); 
         if(t==0){ 
-            c.want.shawarma=true; 
-            c.want.noSauce=rng.chance(30);  // 30%概率不要沙司
+            want.shawarma=true; 
+            want.noSauce=rng.chance(30);  // 30%概率不要沙司
         } else if(t==1){ 
-            c.want.shawarma=true; 
-            c.want.fries=true; 
-        } else { 
-            c.want.shawarma=true; 
-            c.want.cola=true; 
-        } 
-        c.patienceMax=rng.next(80,140); 
-        c.patience=c.patienceMax; 
-        customers.push_back(c); 
-    }
-    
-    // 绘制顶部信息
-    void drawTop(){ 
-        r.drawText(2,1,L"主界面", FOREGROUND_GREEN|FOREGROUND_INTENSITY); 
-        r.drawText(20,1,L"时间: "+std::to_wstring(dayTime), FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED); 
-        r.drawText(35,1,L"金币: "+std::to_wstring(gs.coins), FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED); 
-        r.drawText(55,1,L"容量: "+std::to_wstring(gs.capacity), FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED); 
-    }
-    
-    // 绘制库存信息
-    void drawInventory(){ 
-        r.drawText(2,3,L"库存", FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED); 
-        r.drawText(2,4,L"面饼: "+std::to_wstring(inv.bread)+L"/"+std::to_wstring(inv.breadMax), FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED); 
-        r.drawText(2,5,L"肉: "+std::to_wstring(inv.meat), FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED); 
-        r.drawText(2,6,L"黄瓜: "+std::to_wstring(inv.cucumber), FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED); 
-        r.drawText(2,7,L"沙司: "+std::to_wstring(inv.sauce), FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED); 
-        r.drawText(2,8,L"番茄酱: "+std::to_wstring(inv.ketchup), FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED); 
-        r.drawText(2,9,L"土豆: "+std::to_wstring(inv.potato), FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED); 
-        r.drawText(2,10,L"薯条: "+std::to_wstring(inv.fries), FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED); 
-        r.drawText(2,11,L"可乐: "+std::to_wstring(inv.cola), FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED); 
-        r.drawText(2,12,L"包装纸: "+std::to_wstring(inv.wrapPaper), FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED); 
-        r.drawText(2,13,L"薯条盒: "+std::to_wstring(inv.fryBox), FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED); 
-        r.drawText(2,14,L"可乐杯: "+std::to_wstring(inv.colaCup), FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED); 
-        
-        // 显示准备状态
-        std::wstring fs = friesPrep.ready?L"已完成":(friesPrep.taken?L"已拿":L"空"); 
-        std::wstring cs = colaPrep.ready?L"已完成":(colaPrep.taken?L"已拿":L"空"); 
-        r.drawText(2,15,L"薯条准备: "+fs, FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED); 
-        r.drawText(2,16,L"可乐准备: "+cs, FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED); 
-    }
-    
-    // 获取沙威玛描述
-    std::wstring shawarmaDesc(const Shawarma& s){ 
-        std::wstring t=L""; 
-        if(s.hasMeat) t+=L"肉 "; 
-        if(s.hasCucumber) t+=L"黄瓜 "; 
-        if(s.hasFries) t+=L"薯条 "; 
-        if(s.hasKetchup) t+=L"番茄酱 "; 
-        if(!s.hasSauce) t+=L"无沙司 "; 
-        return t; 
-    }
-    
-    // 绘制工作站状态
-    void drawStations(){ 
-        r.drawText(25,3,L"操作台", FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED); 
-        r.drawText(25,4,L"摊开的面饼: "+(open.state==ShawarmaState::Open?shawarmaDesc(open):L"无"), FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED);
-        
-        r.drawText(25,6,L"包装卷饼(3):", FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED);
-        for(int i=0;i<3;i++){ 
-            std::wstring line=L""; 
-            if(packaged[i].state==ShawarmaState::Wrapped||packaged[i].state==ShawarmaState::Done){ 
-                line=shawarmaDesc(packaged[i]); 
-            } else { 
-                line=L"空"; 
-            } 
-            r.drawText(25,7+i,L"槽"+std::to_wstring(i+1)+L": "+line, FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED); 
-        }
-        
-        r.drawText(25,11,L"烤盘(3):", FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED);
-        for(int i=0;i<3;i++){ 
-            std::wstring line=L""; 
-            if(grilling[i].state==ShawarmaState::Grilling){ 
-                line=L"烤制中"; 
-            } else if(grilling[i].state==ShawarmaState::Done){ 
-                line=L"完成"; 
-            } else { 
-                line=L"空"; 
-            } 
-            r.drawText(25,12+i,L"位"+std::to_wstring(i+1)+L": "+line, FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED); 
-        }
-    }
-    
-    // 绘制顾客队列
-    void drawCustomers(){ 
-        r.drawText(2,18,L"顾客队列", FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED); 
-        for(int i=0;i<(int)customers.size();i++){ 
-            auto& c=customers[i]; 
-            std::wstring want=L""; 
-            if(c.want.shawarma){ 
-                want+=L"饼"; 
-                if(c.want.noSauce) want+=L"(无沙司)"; 
-            } 
-            if(c.want.fries){ want+=L"+薯条"; } 
-            if(c.want.cola){ want+=L"+可乐"; } 
-            r.drawText(2,19+i,L"顾客"+std::to_wstring(i+1)+L": "+want, FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED); 
-            
-            // 绘制耐心条
-            r.drawBar(35,19+i,20,(double)c.patience/c.patienceMax, FOREGROUND_GREEN|FOREGROUND_INTENSITY, FOREGROUND_RED); 
-        }
-        
-        r.drawText(2,19+(int)customers.size(), L"容量: "+std::to_wstring(gs.capacity)+L" 已在店内: "+std::to_wstring((int)customers.size()), FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED);
-    }
-    
-    // 绘制操作帮助
-    void drawHelp(){ 
-        r.drawText(2,r.h-1,L"操作: B放饼 I添加食材 R卷饼 G上烤盘 T取烤 S上菜 F拿薯条 C拿可乐杯 P补货 M切肉 D切土豆 J炸薯条 Q结束", FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED); 
-    }
-    
-    // 绘制消息
-    void drawMsg(){ 
-        r.drawText(2,22,L"消息: "+msg, FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED); 
+            want.shawarma=true; 
+            want.fries=true; 
+        } else { 
+            want.shawarma=true; 
+            want.cola=true; 
+        } 
+        int patienceMax=rng.next(80,140); 
+        customers.add(want, patienceMax, frame); 
+        events.push(frame, EventType::Arrive, (int)orderKind(want), 0); 
+        note(LogFmt::Arrive, frame, (int)orderKind(want), patienceMax); 
     }
     
     // 添加食材到面饼
     void addIngredient(Ingredient ing){ 
-        if(open.state!=ShawarmaState::Open){ 
+        if(wraps.board<0){ 
             msg=L"请先放置面饼"; 
             return; 
         } 
+        uint8_t& open=wraps.ingredients[wraps.board]; 
         
         if(ing==Ingredient::Meat){ 
             if(inv.meat<=0 && gs.upAutoMeat){ 
                 inv.meat = inv.itemMax;  // 自动切肉
             } 
             if(inv.meat>0){ 
-                open.hasMeat=true; 
+                open|=ING_MEAT; 
                 inv.meat--; 
                 if(inv.meat==0 && gs.upAutoMeat){ 
                     inv.meat = inv.itemMax;  // 自动补充
@@ -478,28 +1634,28 @@ struct SceneMain {
             } 
         } else if(ing==Ingredient::Sauce){ 
             if(inv.sauce>0){ 
-                open.hasSauce=true; 
+                open|=ING_SAUCE; 
                 inv.sauce--; 
             } else { 
                 msg=L"沙司不足"; 
             } 
         } else if(ing==Ingredient::Cucumber){ 
             if(inv.cucumber>0){ 
-                open.hasCucumber=true; 
+                open|=ING_CUCUMBER; 
                 inv.cucumber--; 
             } else { 
                 msg=L"黄瓜不足"; 
             } 
         } else if(ing==Ingredient::Fries){ 
             if(inv.fries>0){ 
-                open.hasFries=true; 
+                open|=ING_FRIES; 
                 inv.fries--; 
             } else { 
                 msg=L"薯条库存不足"; 
             } 
         } else if(ing==Ingredient::Ketchup){ 
             if(inv.ketchup>0){ 
-                open.hasKetchup=true; 
+                open|=ING_KETCHUP; 
                 inv.ketchup--; 
             } else { 
                 msg=L"番茄酱不足"; 
@@ -517,8 +1673,6 @@ struct SceneMain {
         } 
     }
     
-    int supplyCycle=0;  // 补货循环索引
-    
     // 循环补货不同物品
     void restockCycle(){ 
         const wchar_t* names[] = {L"面饼",L"黄瓜",L"沙司",L"番茄酱",L"可乐",L"包装纸",L"薯条盒",L"可乐杯"}; 
@@ -631,7 +1785,7 @@ struct SceneMain {
     
     // 放置面饼
     void placeBread(){ 
-        if(open.state==ShawarmaState::Open){ 
+        if(wraps.board>=0){ 
             msg=L"已有面饼"; 
             return; 
         } 
@@ -640,19 +1794,17 @@ struct SceneMain {
             return; 
         } 
         inv.bread--; 
-        open=Shawarma(); 
-        open.state=ShawarmaState::Open; 
-        open.hasSauce=false; 
+        wraps.create(Place{Station::Board,0}, ShawarmaState::Open); 
         msg=L"已放置面饼"; 
     }
     
     // 卷起沙威玛
     void roll(){ 
-        if(open.state!=ShawarmaState::Open){ 
+        if(wraps.board<0){ 
             msg=L"无面饼"; 
             return; 
         } 
-        bool ok = open.hasMeat;  // 必须有肉
+        bool ok = wraps.ingredients[wraps.board]&ING_MEAT;  // 必须有肉
         if(!ok){ 
             msg=L"至少需要肉"; 
             return; 
@@ -662,11 +1814,10 @@ struct SceneMain {
             return; 
         } 
         inv.wrapPaper--; 
-        for(int i=0;i<3;i++){ 
-            if(packaged[i].state==ShawarmaState::Empty){ 
-                packaged[i]=open; 
-                packaged[i].state=ShawarmaState::Wrapped; 
-                open=Shawarma(); 
+        for(int i=0;i<WrapStore::SLOTS;i++){ 
+            if(wraps.pack[i]<0){ 
+                wraps.readyAt[wraps.board]=frame; 
+                wraps.move(wraps.board, Place{Station::Pack,(uint8_t)i}, ShawarmaState::Wrapped); 
                 msg=L"已卷饼"; 
                 return; 
             } 
@@ -676,15 +1827,16 @@ struct SceneMain {
     
     // 将包装好的沙威玛放到烤盘
     void toGrill(){ 
-        for(int i=0;i<3;i++){ 
-            if(packaged[i].state==ShawarmaState::Wrapped){ 
-                for(int j=0;j<3;j++){ 
-                    if(grilling[j].state==ShawarmaState::Empty){ 
-                        grilling[j]=packaged[i]; 
-                        grilling[j].state=ShawarmaState::Grilling; 
-                        grilling[j].grillNeed=10;  // 需要烤10秒
-                        grilling[j].grillTime=0; 
-                        packaged[i]=Shawarma(); 
+        for(int i=0;i<WrapStore::SLOTS;i++){ 
+            int e=wraps.pack[i]; 
+            if(e>=0 && wraps.state[e]==ShawarmaState::Wrapped){ 
+                for(int j=0;j<WrapStore::SLOTS;j++){ 
+                    if(wraps.grill[j]<0){ 
+                        stats.grillIdle.record((uint32_t)(frame-grillIdleSince[j])); 
+                        events.push(frame, EventType::GrillIn, j, 0); 
+                        note(LogFmt::GrillIn, frame, j); 
+                        wraps.move(e, Place{Station::Grill,(uint8_t)j}, ShawarmaState::Grilling); 
+                        wraps.timer[e]=GrillTimer{0,10};  // 需要烤10秒
                         msg=L"已上烤盘"; 
                         return; 
                     } 
@@ -696,13 +1848,16 @@ struct SceneMain {
     
     // 从烤盘取下沙威玛
     void takeFromGrill(){ 
-        for(int j=0;j<3;j++){ 
-            if(grilling[j].state==ShawarmaState::Done){ 
-                for(int i=0;i<3;i++){ 
-                    if(packaged[i].state==ShawarmaState::Empty){ 
-                        packaged[i]=grilling[j]; 
-                        packaged[i].state=ShawarmaState::Done; 
-                        grilling[j]=Shawarma(); 
+        for(int j=0;j<WrapStore::SLOTS;j++){ 
+            int e=wraps.grill[j]; 
+            if(e>=0 && wraps.state[e]==ShawarmaState::Done){ 
+                for(int i=0;i<WrapStore::SLOTS;i++){ 
+                    if(wraps.pack[i]<0){ 
+                        wraps.move(e, Place{Station::Pack,(uint8_t)i}, ShawarmaState::Done); 
+                        wraps.readyAt[e]=frame; 
+                        grillIdleSince[j]=frame; 
+                        events.push(frame, EventType::GrillOut, j, 0); 
+                        note(LogFmt::GrillOut, frame, j); 
                         msg=L"取下完成卷饼"; 
                         return; 
                     } 
@@ -712,32 +1867,35 @@ struct SceneMain {
         msg=L"暂无已烤好卷饼"; 
     }
     
-    // 检查沙威玛是否符合顾客订单
-    bool matchOrder(const Shawarma& s, const Customer& c){ 
-        if(!c.want.shawarma) return false; 
-        if(c.want.noSauce && s.hasSauce) return false; 
-        return (s.state==ShawarmaState::Wrapped || s.state==ShawarmaState::Done); 
+    // 检查卷饼(实体)是否符合订单
+    bool matchOrder(int wrap, const OrderItem& want) const { 
+        if(!want.shawarma) return false; 
+        if(want.noSauce && (wraps.ingredients[wrap]&ING_SAUCE)) return false; 
+        ShawarmaState st=wraps.state[wrap]; 
+        return st==ShawarmaState::Wrapped || st==ShawarmaState::Done; 
+    }
+    
+    // 包装槽中第一个符合订单的卷饼, 没有则返回-1
+    int findWrap(const OrderItem& want) const { 
+        for(int i=0;i<WrapStore::SLOTS;i++){ 
+            int e=wraps.pack[i]; 
+            if(e>=0 && matchOrder(e, want)) return e; 
+        } 
+        return -1; 
     }
     
     // 服务顾客
     void serve(){ 
-        for(size_t ci=0; ci<customers.size(); ++ci){ 
-            auto& c=customers[ci]; 
-            if(c.served) continue; 
-            
-            int shawIdx=-1; 
-            for(int i=0;i<3;i++){ 
-                if(packaged[i].state!=ShawarmaState::Empty && matchOrder(packaged[i], c)){ 
-                    shawIdx=i; 
-                    break; 
-                } 
-            }
+        for(int ci=0; ci<customers.size(); ++ci){ 
+            if(customers.served[ci]) continue; 
+            const OrderItem& want=customers.order[ci]; 
             
-            if(shawIdx==-1) continue; 
+            int wrap=findWrap(want); 
+            if(wrap<0) continue; 
             
             // 检查小吃是否准备好
-            bool friesOk = !c.want.fries || friesPrep.ready; 
-            bool colaOk = !c.want.cola || colaPrep.ready; 
+            bool friesOk = !want.fries || friesPrep.ready; 
+            bool colaOk = !want.cola || colaPrep.ready; 
             
             if(!friesOk){ 
                 msg=L"薯条未完成"; 
@@ -749,20 +1907,30 @@ struct SceneMain {
             } 
             
             // 计算总价
-            int gain = priceShawarma(packaged[shawIdx]); 
-            if(c.want.fries){ 
+            int gain = priceShawarma(wraps.ingredients[wrap]); 
+            if(want.fries){ 
                 gain += priceFries(); 
                 friesPrep = Prep();  // 重置薯条状态
             } 
-            if(c.want.cola){ 
+            if(want.cola){ 
                 gain += priceCola(); 
                 colaPrep = Prep();   // 重置可乐状态
             } 
             
             // 完成交易
             gs.coins += gain; 
-            packaged[shawIdx]=Shawarma();  // 清空包装槽
-            c.served=true; 
+            int kind=(int)orderKind(want); 
+            uint32_t waited=(uint32_t)(frame-customers.arrive[ci]); 
+            int readySince=std::max(customers.arrive[ci], wraps.readyAt[wrap]);  // 饼和顾客都到位的时刻
+            stats.revenue += gain; 
+            stats.served[kind]++; 
+            stats.serve.record((uint32_t)(frame-readySince)); 
+            stats.wait.record(waited); 
+            secRevenue += gain; 
+            events.push(frame, EventType::Serve, kind, gain); 
+            note(LogFmt::Serve, frame, kind, gain, (int)waited); 
+            wraps.destroy(wrap);  // 清空包装槽
+            customers.served[ci]=1; 
             msg=L"交易成功 +"+std::to_wstring(gain); 
             return; 
         } 
@@ -781,113 +1949,1103 @@ struct SceneMain {
     
     // 每秒更新
     void tickSecond(){ 
-        // 更新烤制进度
-        for(int j=0;j<3;j++){ 
-            if(grilling[j].state==ShawarmaState::Grilling){ 
-                grilling[j].grillTime++; 
-                if(grilling[j].grillTime>=grilling[j].grillNeed){ 
-                    grilling[j].state=ShawarmaState::Done; 
-                } 
+        // 更新烤制进度: 只扫状态与计时组件
+        for(int e=0;e<wraps.size();e++){ 
+            if(wraps.state[e]==ShawarmaState::Grilling){ 
+                GrillTimer& t=wraps.timer[e]; 
+                if(++t.time>=t.need) wraps.state[e]=ShawarmaState::Done; 
             } 
         }
         
         // 生成新顾客
-        if((int)customers.size() < gs.capacity+3 && rng.chance(10)) spawnCustomer(); 
+        if(customers.size() < gs.capacity+3 && rng.chance(10)) spawnCustomer(); 
         
-        // 更新顾客耐心
-        for(auto& c: customers){ 
-            if(!c.served){ 
-                c.patience--; 
-            } 
+        // 更新顾客耐心: 只扫耐心与服务标记
+        for(int i=0;i<customers.size();i++){ 
+            if(!customers.served[i]) customers.patience[i].left--; 
         }
         
-        // 移除已服务或没耐心的顾客
-        while(!customers.empty() && (customers.front().patience<=0 || customers.front().served)){ 
-            if(!customers.front().served){ 
+        // 移除队首已服务或没耐心的顾客
+        int gone=0; 
+        while(gone<customers.size() && (customers.patience[gone].left<=0 || customers.served[gone])){ 
+            if(!customers.served[gone]){ 
                 // 顾客离开但没有购买
+                int kind=(int)orderKind(customers.order[gone]); 
+                int waited=frame-customers.arrive[gone]; 
+                stats.lost[kind]++; 
+                stats.wait.record((uint32_t)waited); 
+                events.push(frame, EventType::Lost, kind, waited); 
+                note(LogFmt::Lost, frame, kind, waited); 
             } 
-            customers.pop_front(); 
+            gone++; 
         }
+        if(gone) customers.popFront(gone);
         
+        stats.bestSecond = std::max(stats.bestSecond, secRevenue); 
+        secRevenue=0; 
         dayTime--;  // 减少剩余时间
     }
     
-    // 主场景循环
-    void loop(){ 
-        wchar_t ch; 
-        int ingCycle=0;  // 食材循环索引
+    // 推进一帧, 每满一秒执行一次 tickSecond
+    void stepFrame(){ 
+        frame++; 
+        secCounter++; 
+        if(secCounter>=FPS){ 
+            tickSecond(); 
+            secCounter=0; 
+        } 
+    }
+    
+    // 处理一个操作按键(不含退出)
+    void handleKey(wchar_t ch){ 
+        note(LogFmt::Action, frame, (int)ch); 
+        if(ch==L'B'||ch==L'b') placeBread();
+        else if(ch==L'I'||ch==L'i'){ 
+            // 智能添加：如果正在准备薯条或可乐，则添加对应食材
+            if(friesPrep.taken && !friesPrep.ready){ 
+                addFriesIngredient(); 
+            } else if(colaPrep.taken && !colaPrep.ready){ 
+                addColaIngredient(); 
+            } else { 
+                // 否则循环添加食材到面饼
+                Ingredient arr[5]={Ingredient::Meat,Ingredient::Cucumber,Ingredient::Fries,Ingredient::Ketchup,Ingredient::Sauce}; 
+                addIngredient(arr[ingCycle]); 
+                ingCycle=(ingCycle+1)%5; 
+            } 
+        }
+        else if(ch==L'R'||ch==L'r') roll();
+        else if(ch==L'G'||ch==L'g') toGrill();
+        else if(ch==L'T'||ch==L't') takeFromGrill();
+        else if(ch==L'S'||ch==L's') serve();
+        else if(ch==L'F'||ch==L'f') takeFries();
+        else if(ch==L'C'||ch==L'c') takeColaCup();
+        else if(ch==L'P'||ch==L'p'){ restockCycle(); }
+        else if(ch==L'M'||ch==L'm') cutMeat();
+        else if(ch==L'D'||ch==L'd') cutPotato();
+        else if(ch==L'J'||ch==L'j') fryFriesFromPotato();
+    }
+    
+    // 结算当天统计: 补记仍在空闲的烤盘位, 打烊时还在排队的顾客计为流失
+    void finishStats(){ 
+        for(int j=0;j<WrapStore::SLOTS;j++){ 
+            if(wraps.grill[j]<0) stats.grillIdle.record((uint32_t)(frame-grillIdleSince[j])); 
+        } 
+        for(int i=0;i<customers.size();i++){ 
+            if(customers.served[i]) continue; 
+            int kind=(int)orderKind(customers.order[i]); 
+            int waited=frame-customers.arrive[i]; 
+            stats.lost[kind]++; 
+            stats.wait.record((uint32_t)waited); 
+            events.push(frame, EventType::Lost, kind, waited); 
+            note(LogFmt::Lost, frame, kind, waited); 
+        } 
+        stats.day=gs.day; 
+        stats.frames=frame; 
+    }
+};
+
+// 分店店员 - 按固定优先级代替玩家按键: 能上菜先上菜, 其次取烤/上烤, 最后做饼
+struct Staff {
+    static constexpr int ACTION_FRAMES=6;  // 每6帧一个动作, 约每秒4次
+    
+    // 选出下一个按键, 0表示无事可做
+    static wchar_t decide(const Shop& s){ 
+        const Inventory& v=s.inv; 
+        const WrapStore& w=s.wraps; 
+        bool slotFree=false, wrapped=false, grillFree=false, grillDone=false; 
+        for(int i=0;i<WrapStore::SLOTS;i++){ 
+            ShawarmaState p=w.stateAt(Place{Station::Pack,(uint8_t)i}), g=w.stateAt(Place{Station::Grill,(uint8_t)i}); 
+            slotFree |= p==ShawarmaState::Empty; 
+            wrapped |= p==ShawarmaState::Wrapped; 
+            grillFree |= g==ShawarmaState::Empty; 
+            grillDone |= g==ShawarmaState::Done; 
+        } 
         
-        while(dayTime>0){ 
-            r.clear(L' ', FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED); 
+        // 与 serve 相同的顺序找第一位有饼可上的顾客, 先备齐薯条/可乐
+        for(int i=0;i<s.customers.size();i++){ 
+            if(s.customers.served[i]) continue; 
+            const OrderItem& want=s.customers.order[i]; 
+            if(s.findWrap(want)<0) continue; 
+            if(want.fries && !s.friesPrep.ready){ 
+                if(!s.friesPrep.taken) return v.fryBox>0 ? L'F' : L'P'; 
+                if(v.fries>0) return L'I'; 
+                return v.potato>0 ? L'J' : L'D'; 
+            } 
+            if(want.cola && !s.colaPrep.ready){ 
+                if(!s.colaPrep.taken) return v.colaCup>0 ? L'C' : L'P'; 
+                return v.cola>0 ? L'I' : L'P'; 
+            } 
+            return L'S'; 
+        } 
+        
+        if(grillDone && slotFree) return L'T'; 
+        if(wrapped && grillFree) return L'G'; 
+        
+        // 做饼: 按食材循环加到番茄酱为止, 不加沙司的饼任何顾客都接受
+        if(w.board>=0){ 
+            if(s.ingCycle==0 && v.meat<=0 && !s.gs.upAutoMeat) return L'M'; 
+            if(s.ingCycle!=4 || !(w.ingredients[w.board]&ING_MEAT)) return L'I'; 
+            if(!slotFree) return 0; 
+            return v.wrapPaper>0 ? L'R' : L'P'; 
+        } 
+        if(slotFree && !s.customers.empty()){ 
+            if(s.ingCycle!=0) return L'I';  // 没有面饼时空转食材循环, 回到肉
+            return v.bread>0 ? L'B' : L'P'; 
+        } 
+        return 0; 
+    }
+};
+
+// 分店经营 - 玩家营业的同时, 各分店在工作线程上无界面地模拟同一天;
+// 工作线程按墙钟跟上玩家的帧, 每帧只用固定的CPU预算, 各店轮流推进一小段, 超时即让出;
+// 界面线程从不等待工作线程, 只读各店的无锁快照, 收工时再结算
+struct Franchise {
+    static constexpr int BUDGET_US=2000;   // 每个工作线程每帧最多占用的CPU时间(微秒)
+    static constexpr int SLICE_FRAMES=FPS; // 轮转粒度: 每家店一次最多推进的帧数
+    
+    // 一家分店: 自己的升级与金币 + 完整的店铺模拟
+    struct Outlet { 
+        GameState gs; 
+        Shop shop; 
+        int nextAction=0;     // 店员下次动作的帧
+        bool finished=false;  // 当天已结束(仅工作线程读写)
+        StatsSnapshot live;   // 实时数据
+        
+        Outlet(const Branch& b, int day):shop(gs, b.seed+(unsigned)day*0x9E3779B9u){ 
+            gs.day=day; 
+            gs.upAutoMeat=b.upAutoMeat; 
+            gs.upGoldPlate=b.upGoldPlate; 
+            gs.upExpand=b.upExpand; 
+            if(b.upExpand) gs.capacity+=3; 
+            shop.logging=false; 
+        } 
+        
+        BranchStats stats() const { 
+            BranchStats st; 
+            st.frame=shop.frame; 
+            st.dayTime=shop.dayTime; 
+            st.coins=gs.coins; 
+            st.served=shop.stats.servedTotal(); 
+            st.lost=shop.stats.lostTotal(); 
+            st.waiting=shop.customers.size(); 
+            return st; 
+        } 
+    };
+    
+    std::vector<std::unique_ptr<Outlet>> outlets;  // 仅界面线程增删
+    std::vector<std::thread> workers;              // 工作线程
+    std::atomic<int> finishedCount{0};             // 已结束的分店数
+    std::atomic<bool> rush{false};                 // 玩家已收工: 不再限速, 尽快跑到收工帧
+    std::atomic<int> closeFrame{INT32_MAX};        // 玩家收工时的帧, 分店到此打烊
+    std::atomic<bool> stopping{false};             // 退出程序
+    std::chrono::steady_clock::time_point dayStart;
+    bool settled=true;                             // 当天收入已并入总店
+    
+    ~Franchise(){ 
+        stopping=true; 
+        join(); 
+    }
+    
+    // 开始新的一天: 每家分店用当天的种子重建, 按店分给工作线程
+    void startDay(const GameState& g){ 
+        join(); 
+        outlets.clear(); 
+        for(const Branch& b: g.branches) outlets.push_back(std::make_unique<Outlet>(b, g.day)); 
+        finishedCount=0; 
+        rush=false; 
+        closeFrame=INT32_MAX; 
+        settled=outlets.empty(); 
+        dayStart=std::chrono::steady_clock::now(); 
+        if(outlets.empty()) return; 
+        int hw=(int)std::thread::hardware_concurrency(); 
+        int n=std::max(1, std::min((int)outlets.size(), hw-1));  // 给界面线程留一个核
+        for(int i=0;i<n;i++) workers.emplace_back([this,i,n]{ work(i,n); }); 
+    }
+    
+    // 玩家当天结束(提前收工时 lastFrame 小于整天帧数), 分店不再跟随墙钟, 跑到同一帧后打烊
+    void finishDay(int lastFrame){ 
+        closeFrame.store(lastFrame, std::memory_order_relaxed); 
+        rush.store(true, std::memory_order_release); 
+    }
+    
+    // 所有分店都已跑完当天
+    bool done() const { return finishedCount.load(std::memory_order_acquire)==(int)outlets.size(); }
+    
+    // 结算: 分店当天收入并入总店金币, 需在 done() 之后调用, 返回总收入
+    int settle(GameState& g){ 
+        if(settled || !done()) return 0; 
+        join(); 
+        int income=0; 
+        for(int i=0;i<(int)outlets.size();i++){ 
+            BranchStats st=outlets[i]->live.read(); 
+            income+=st.coins; 
+            logger().log(LogFmt::BranchSettle, i+1, g.day, st.coins, st.served, st.lost); 
+        } 
+        g.coins+=income; 
+        settled=true; 
+        return income; 
+    }
+    
+    // 各分店的最新数据
+    std::vector<BranchStats> view() const { 
+        std::vector<BranchStats> v; 
+        for(auto& o: outlets) v.push_back(o->live.read()); 
+        return v; 
+    }
+    
+    void join(){ 
+        for(auto& t: workers) t.join(); 
+        workers.clear(); 
+    }
+    
+    // 推进一家分店一帧: 到点由店员做一个动作
+    static void step(Outlet& o){ 
+        if(o.shop.frame>=o.nextAction){ 
+            wchar_t k=Staff::decide(o.shop); 
+            if(k) o.shop.handleKey(k); 
+            o.nextAction=o.shop.frame+Staff::ACTION_FRAMES; 
+        } 
+        o.shop.stepFrame(); 
+        if(o.shop.dayTime<=0) close(o); 
+    }
+    
+    // 分店打烊: 结算当天统计(仍在排队的顾客计为流失)
+    static void close(Outlet& o){ 
+        o.shop.finishStats(); 
+        o.finished=true; 
+    }
+    
+    // 工作线程: 负责编号为 first, first+stride, ... 的分店
+    void work(int first, int stride){ 
+        using clock=std::chrono::steady_clock; 
+        const auto slot=std::chrono::microseconds(1000000/FPS); 
+        auto next=clock::now(); 
+        int remaining=0; 
+        for(int i=first;i<(int)outlets.size();i+=stride) remaining++; 
+        while(remaining>0 && !stopping.load(std::memory_order_relaxed)){ 
+            bool fast=rush.load(std::memory_order_acquire); 
+            auto t0=clock::now(); 
+            auto deadline=t0+std::chrono::microseconds(BUDGET_US); 
+            int target=fast ? closeFrame.load(std::memory_order_relaxed) : (int)((t0-dayStart)/slot)+1;  // 收工帧或墙钟对应的帧
             
-            // 更新时间
-            secCounter++; 
-            if(secCounter>=24){ 
-                tickSecond(); 
-                secCounter=0; 
+            // 轮转推进, 直到都跟上或用完本帧预算
+            bool progress=true; 
+            while(progress){ 
+                progress=false; 
+                for(int i=first;i<(int)outlets.size();i+=stride){ 
+                    Outlet& o=*outlets[i]; 
+                    if(o.finished) continue; 
+                    if(o.shop.frame<target){ 
+                        int end=std::min(target, o.shop.frame+SLICE_FRAMES); 
+                        while(!o.finished && o.shop.frame<end) step(o); 
+                    } else if(fast) close(o);  // 已到玩家收工的帧
+                    else continue; 
+                    o.live.publish(o.stats()); 
+                    if(o.finished){ 
+                        remaining--; 
+                        finishedCount.fetch_add(1, std::memory_order_release); 
+                    } 
+                    progress=true; 
+                } 
+                if(!fast && clock::now()>=deadline) break; 
             } 
             
-            // 绘制所有界面元素
-            drawTop(); 
-            drawInventory(); 
-            drawStations(); 
-            drawCustomers(); 
-            drawHelp(); 
-            drawMsg(); 
-            r.present(); 
+            // 限速时睡到下一帧; 落后太多则从现在重新计时
+            if(!fast){ 
+                next+=slot; 
+                if(next<clock::now()) next=clock::now(); 
+                std::this_thread::sleep_until(next); 
+            } 
+        } 
+    }
+};
+
+// 分店行可选的列(按位组合)
+enum BranchField : unsigned { 
+    BF_TIME=1,     // 剩余时间
+    BF_COINS=2,    // 当天收入
+    BF_SERVED=4,   // 成交
+    BF_LOST=8,     // 流失
+    BF_WAITING=16, // 排队
+};
+
+// 逐行绘制各分店数据(入口界面与主界面共用): 第i家店画在 (x0, y0+i), 依次画出 fields 所选的列, 超出屏幕右边时裁剪
+inline void drawBranchRows(Renderer& r, int x0, int y0, const std::vector<BranchStats>& v, unsigned fields){ 
+    WORD attr = FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED; 
+    for(int i=0;i<(int)v.size();i++){ 
+        const BranchStats& b=v[i]; 
+        int y=y0+i; 
+        int x=r.drawField(x0,y,L"#",std::to_wstring(i+1), attr, r.w-x0); 
+        if(fields&BF_TIME) x=r.drawField(x,y,L" 剩余",std::to_wstring(b.dayTime)+L"秒", attr, r.w-x); 
+        if(fields&BF_COINS) x=r.drawField(x,y,L" +",std::to_wstring(b.coins), attr, r.w-x); 
+        if(fields&BF_SERVED) x=r.drawField(x,y,L" 成交",std::to_wstring(b.served), attr, r.w-x); 
+        if(fields&BF_LOST) x=r.drawField(x,y,L" 流失",std::to_wstring(b.lost), attr, r.w-x); 
+        if(fields&BF_WAITING) x=r.drawField(x,y,L" 排队",std::to_wstring(b.waiting), attr, r.w-x); 
+    } 
+}
+
+// 绘制分店实时数据
+inline void SceneEntrance::drawBranches(){ 
+    if(gs.branches.empty()) return; 
+    const int x0=56; 
+    r.drawField(x0,4,L"分店: ",std::to_wstring(gs.branches.size())+L"家", FOREGROUND_GREEN|FOREGROUND_INTENSITY); 
+    drawBranchRows(r, x0, 5, fr.view(), BF_TIME|BF_COINS|BF_SERVED|BF_LOST); 
+}
+
+// 主游戏场景类 - 在店铺模拟之上负责绘制、回溯与逐帧循环
+struct SceneMain : Shop {
+    Renderer& r;     // 渲染器引用
+    
+    RewindRing rewind{sizeof(SimFrame), FPS*2, 90};  // 每2秒一个关键帧, 保留最近3分钟
+    SimFrame scratch;         // 快照暂存区
+    int viewTick=-1;          // 回溯查看中的帧, -1表示实时
+    double restoreUs=0;       // 最近一次恢复耗时(微秒)
+    const Franchise* fr=nullptr;  // 后台分店(可无)
+    
+    // 面板列位置与宽度(按显示列计, 中文占两列)
+    static constexpr int COL_INV=2;        // 库存/顾客/消息
+    static constexpr int COL_STATION=25;   // 操作台
+    static constexpr int COL_BAR=35;       // 耐心条
+    static constexpr int COL_KITCHEN=64;   // 厨房画面/性能
+    static constexpr int INV_W=COL_STATION-1-COL_INV; 
+    static constexpr int STATION_W=COL_KITCHEN-1-COL_STATION; 
+    static constexpr const wchar_t* SLOT_LABELS[3]={L"槽1: ",L"槽2: ",L"槽3: "}; 
+    static constexpr const wchar_t* GRILL_LABELS[3]={L"位1: ",L"位2: ",L"位3: "}; 
+    
+    SceneMain(GameState& g, Renderer& rr):Shop(g,clockSeed()),r(rr){}
+    
+    // 记录本帧快照
+    void record(){ 
+        if(!rewind.empty() && frame<=rewind.newestTick()) rewind.truncate(frame-1);  // 覆盖回溯点之后的记录
+        capture(scratch); 
+        rewind.push(frame, &scratch); 
+    }
+    
+    // 跳转到指定帧(限制在缓冲范围内)
+    void seek(int tick){ 
+        if(rewind.empty()) return; 
+        int from = viewTick<0 ? frame : viewTick; 
+        tick = std::clamp(tick, rewind.oldestTick(), rewind.newestTick()); 
+        auto t0 = std::chrono::steady_clock::now(); 
+        rewind.restore(tick, &scratch); 
+        load(scratch); 
+        restoreUs = std::chrono::duration<double,std::micro>(std::chrono::steady_clock::now()-t0).count(); 
+        logger().log(LogFmt::Rewind, from, tick, (int)restoreUs); 
+        viewTick = tick==rewind.newestTick() ? -1 : tick; 
+        msg = viewTick<0 ? L"已回到最新" : L"回溯中: Z后退 X前进 其他键从此继续"; 
+    }
+    
+    // 绘制顶部信息
+    void drawTop(){ 
+        r.drawLabel(COL_INV,1,L"主界面", FOREGROUND_GREEN|FOREGROUND_INTENSITY); 
+        r.drawField(20,1,L"时间: ",std::to_wstring(dayTime), FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED); 
+        r.drawField(35,1,L"金币: ",std::to_wstring(gs.coins), FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED); 
+        r.drawField(55,1,L"容量: ",std::to_wstring(gs.capacity), FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED); 
+    }
+    
+    // 绘制库存信息
+    void drawInventory(){ 
+        r.drawLabel(COL_INV,3,L"库存", FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED, INV_W); 
+        r.drawField(COL_INV,4,L"面饼: ",std::to_wstring(inv.bread)+L"/"+std::to_wstring(inv.breadMax), FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED, INV_W); 
+        r.drawField(COL_INV,5,L"肉: ",std::to_wstring(inv.meat), FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED, INV_W); 
+        r.drawField(COL_INV,6,L"黄瓜: ",std::to_wstring(inv.cucumber), FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED, INV_W); 
+        r.drawField(COL_INV,7,L"沙司: ",std::to_wstring(inv.sauce), FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED, INV_W); 
+        r.drawField(COL_INV,8,L"番茄酱: ",std::to_wstring(inv.ketchup), FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED, INV_W); 
+        r.drawField(COL_INV,9,L"土豆: ",std::to_wstring(inv.potato), FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED, INV_W); 
+        r.drawField(COL_INV,10,L"薯条: ",std::to_wstring(inv.fries), FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED, INV_W); 
+        r.drawField(COL_INV,11,L"可乐: ",std::to_wstring(inv.cola), FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED, INV_W); 
+        r.drawField(COL_INV,12,L"包装纸: ",std::to_wstring(inv.wrapPaper), FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED, INV_W); 
+        r.drawField(COL_INV,13,L"薯条盒: ",std::to_wstring(inv.fryBox), FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED, INV_W); 
+        r.drawField(COL_INV,14,L"可乐杯: ",std::to_wstring(inv.colaCup), FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED, INV_W); 
+        
+        // 显示准备状态
+        const wchar_t* fs = friesPrep.ready?L"已完成":(friesPrep.taken?L"已拿":L"空"); 
+        const wchar_t* cs = colaPrep.ready?L"已完成":(colaPrep.taken?L"已拿":L"空"); 
+        r.drawField(COL_INV,15,L"薯条准备: ",fs, FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED, INV_W); 
+        r.drawField(COL_INV,16,L"可乐准备: ",cs, FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED, INV_W); 
+    }
+    
+    // 获取沙威玛描述
+    std::wstring shawarmaDesc(uint8_t ing){ 
+        std::wstring t=L""; 
+        if(ing&ING_MEAT) t+=L"肉 "; 
+        if(ing&ING_CUCUMBER) t+=L"黄瓜 "; 
+        if(ing&ING_FRIES) t+=L"薯条 "; 
+        if(ing&ING_KETCHUP) t+=L"番茄酱 "; 
+        if(!(ing&ING_SAUCE)) t+=L"无沙司 "; 
+        return t; 
+    }
+    
+    // 绘制工作站状态
+    void drawStations(){ 
+        r.drawLabel(COL_STATION,3,L"操作台", FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED, STATION_W); 
+        r.drawField(COL_STATION,4,L"摊开的面饼: ",wraps.board>=0?shawarmaDesc(wraps.ingredients[wraps.board]):L"无", FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED, STATION_W);
+        
+        r.drawLabel(COL_STATION,6,L"包装卷饼(3):", FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED, STATION_W);
+        for(int i=0;i<WrapStore::SLOTS;i++){ 
+            int e=wraps.pack[i]; 
+            std::wstring line = e>=0 ? shawarmaDesc(wraps.ingredients[e]) : L"空"; 
+            r.drawField(COL_STATION,7+i,SLOT_LABELS[i],line, FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED, STATION_W); 
+        }
+        
+        r.drawLabel(COL_STATION,11,L"烤盘(3):", FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED, STATION_W);
+        for(int i=0;i<WrapStore::SLOTS;i++){ 
+            const wchar_t* line=L""; 
+            ShawarmaState st=wraps.stateAt(Place{Station::Grill,(uint8_t)i}); 
+            if(st==ShawarmaState::Grilling){ 
+                line=L"烤制中"; 
+            } else if(st==ShawarmaState::Done){ 
+                line=L"完成"; 
+            } else { 
+                line=L"空"; 
+            } 
+            r.drawField(COL_STATION,12+i,GRILL_LABELS[i],line, FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED, STATION_W); 
+        }
+    }
+    
+    // 绘制顾客队列
+    void drawCustomers(){ 
+        r.drawLabel(COL_INV,18,L"顾客队列", FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED); 
+        for(int i=0;i<customers.size();i++){ 
+            const OrderItem& o=customers.order[i]; 
+            std::wstring want=L""; 
+            if(o.shawarma){ 
+                want+=L"饼"; 
+                if(o.noSauce) want+=L"(无沙司)"; 
+            } 
+            if(o.fries){ want+=L"+薯条"; } 
+            if(o.cola){ want+=L"+可乐"; } 
+            int x=r.drawField(COL_INV,19+i,L"顾客",std::to_wstring(i+1), FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED); 
+            r.drawField(x,19+i,L": ",want, FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED, COL_BAR-1-x); 
             
-            // 处理按键输入
-            if(in.pollKey(ch)){
-                if(ch==L'B'||ch==L'b') placeBread();
-                else if(ch==L'I'||ch==L'i'){ 
-                    // 智能添加：如果正在准备薯条或可乐，则添加对应食材
-                    if(friesPrep.taken && !friesPrep.ready){ 
-                        addFriesIngredient(); 
-                    } else if(colaPrep.taken && !colaPrep.ready){ 
-                        addColaIngredient(); 
-                    } else { 
-                        // 否则循环添加食材到面饼
-                        Ingredient arr[5]={Ingredient::Meat,Ingredient::Cucumber,Ingredient::Fries,Ingredient::Ketchup,Ingredient::Sauce}; 
-                        addIngredient(arr[ingCycle]); 
-                        ingCycle=(ingCycle+1)%5; 
-                    } 
-                }
-                else if(ch==L'R'||ch==L'r') roll();
-                else if(ch==L'G'||ch==L'g') toGrill();
-                else if(ch==L'T'||ch==L't') takeFromGrill();
-                else if(ch==L'S'||ch==L's') serve();
-                else if(ch==L'F'||ch==L'f') takeFries();
-                else if(ch==L'C'||ch==L'c') takeColaCup();
-                else if(ch==L'P'||ch==L'p'){ restockCycle(); }
-                else if(ch==L'M'||ch==L'm') cutMeat();
-                else if(ch==L'D'||ch==L'd') cutPotato();
-                else if(ch==L'J'||ch==L'j') fryFriesFromPotato();
-                else if(ch==L'Q'||ch==L'q') break;  // 提前结束当天
+            // 绘制耐心条
+            const Patience& p=customers.patience[i]; 
+            r.drawBar(COL_BAR,19+i,20,(double)p.left/p.max, FOREGROUND_GREEN|FOREGROUND_INTENSITY, FOREGROUND_RED); 
+        }
+        
+        int x=r.drawField(COL_INV,19+customers.size(),L"容量: ",std::to_wstring(gs.capacity), FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED); 
+        r.drawField(x,19+customers.size(),L" 已在店内: ",std::to_wstring(customers.size()), FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED);
+    }
+    
+    // 绘制操作帮助
+    void drawHelp(){ 
+        // 整行超过屏宽, 分两行显示
+        r.drawLabel(COL_INV,r.h-2,L"操作: B放饼 I添加食材 R卷饼 G上烤盘 T取烤 S上菜 F拿薯条 C拿可乐杯", FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED); 
+        r.drawLabel(COL_INV,r.h-1,L"      P补货 M切肉 D切土豆 J炸薯条 Z/X回溯 Q结束", FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED); 
+    }
+    
+    // 绘制消息
+    void drawMsg(){ 
+        r.drawField(COL_INV,17,L"消息: ",msg, FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED, COL_KITCHEN-1-COL_INV); 
+    }
+    
+    // 绘制厨房画面(精灵)
+    void drawKitchen(){ 
+        const KitchenSprites& k = kitchenSprites(); 
+        const int x0=COL_KITCHEN; 
+        r.drawLabel(x0,3,L"厨房", FOREGROUND_GREEN|FOREGROUND_INTENSITY); 
+        for(int i=0;i<customers.size() && i<4;i++){ 
+            if(customers.served[i]) continue; 
+            const Patience& p=customers.patience[i]; 
+            int pct = p.left*100/p.max; 
+            int id = pct>60 ? k.customer[0] : (pct>30 ? k.customer[1] : k.customer[2]); 
+            r.blit(k.atlas, id, x0+i*9, 4); 
+        } 
+        for(int j=0;j<WrapStore::SLOTS;j++){ 
+            if(wraps.grill[j]<0) r.blit(k.atlas, k.grillEmpty, x0+j*9, 11); 
+        } 
+        // 卷饼按位置与状态组件绘制
+        for(int e=0;e<wraps.size();e++){ 
+            Place p=wraps.place[e]; 
+            ShawarmaState st=wraps.state[e]; 
+            int x=x0+p.slot*9; 
+            if(p.station==Station::Pack) r.blit(k.atlas, st==ShawarmaState::Done ? k.wrapDone : k.wrapRaw, x, 8); 
+            else if(p.station==Station::Grill) r.blit(k.atlas, st==ShawarmaState::Done ? k.grillDone : k.grillCooking, x, 11); 
+        } 
+    }
+    
+    // 绘制性能信息
+    void drawProfiler(){ 
+        WORD attr = FOREGROUND_BLUE|FOREGROUND_GREEN; 
+        int wMax = r.w-COL_KITCHEN; 
+        r.drawLabel(COL_KITCHEN,15,L"性能", FOREGROUND_GREEN|FOREGROUND_INTENSITY); 
+        int x=r.drawField(COL_KITCHEN,16,L"回溯: ",fmtSec((uint32_t)(rewind.newestTick()-rewind.oldestTick()+1))+L"秒", attr); 
+        x=r.drawField(x,16,L" 内存 ",std::to_wstring(rewind.memoryBytes()/1024)+L"KB", attr, r.w-x); 
+        x=r.drawField(COL_KITCHEN,17,L"恢复 ",std::to_wstring((int)restoreUs)+L"us", attr); 
+        if(viewTick>=0) r.drawField(x,17,L" [查看 ",fmtSec((uint32_t)viewTick)+L"]", attr, r.w-x); 
+        wchar_t rate[16]; 
+        swprintf(rate, 16, L"%.1f%%", r.text.hitRate()*100); 
+        r.drawField(COL_KITCHEN,18,L"排版缓存命中 ",rate, attr, wMax); 
+    }
+    
+    // 绘制分店实时数据
+    void drawFranchise(){ 
+        if(!fr || fr->outlets.empty()) return; 
+        r.drawLabel(COL_KITCHEN,20,L"分店", FOREGROUND_GREEN|FOREGROUND_INTENSITY); 
+        drawBranchRows(r, COL_KITCHEN, 21, fr->view(), BF_COINS|BF_SERVED|BF_WAITING); 
+    }
+    
+    // 绘制整个主界面
+    void draw(){ 
+        r.clear(L' ', FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED); 
+        drawTop(); 
+        drawInventory(); 
+        drawStations(); 
+        drawCustomers(); 
+        drawHelp(); 
+        drawMsg(); 
+        drawKitchen(); 
+        drawProfiler(); 
+        drawFranchise(); 
+    }
+    
+    // 主场景循环
+    SceneTask loop(Scheduler& s){ 
+        logger().log(LogFmt::DayStart, gs.day, gs.coins); 
+        while(dayTime>0){ 
+            // 更新时间(回溯查看时暂停)
+            if(viewTick<0) stepFrame(); 
+            
+            draw(); 
+            
+            // 等待下一帧并处理按键输入
+            wchar_t ch = co_await s.frame(); 
+            bool key = ch!=0; 
+            if(key && (ch==L'Z'||ch==L'z')){ 
+                seek((viewTick<0?frame:viewTick)-FPS);  // 后退1秒
+                key=false; 
+            } else if(key && (ch==L'X'||ch==L'x')){ 
+                if(viewTick>=0) seek(viewTick+FPS);   // 前进1秒
+                key=false; 
+            } else if(key && viewTick>=0){ 
+                viewTick=-1;  // 从回溯点继续, 之后的记录在本帧保存时被覆盖
+                events.truncate(eventsAtLoad); 
+            } 
+            if(key){
+                if(ch==L'Q'||ch==L'q') break;  // 提前结束当天
+                handleKey(ch); 
             }
-            Sleep(1000/24);  // 控制帧率
+            if(viewTick<0) record(); 
         }
+        finishStats(); 
+        logger().log(LogFmt::DayEnd, gs.day, stats.revenue, stats.servedTotal(), stats.lostTotal()); 
+        
+        // 停留片刻显示结束信息
+        msg=L"今日营业结束 收入 +"+std::to_wstring(stats.revenue); 
+        draw(); 
+        co_await s.sleep(1000); 
+    }
+};
+
+// 入口界面主循环
+SceneTask SceneEntrance::loop(Scheduler& s){ 
+    while(true){ 
+        draw(); 
+        wchar_t ch = co_await s.frame(); 
+        if(ch==L'N'||ch==L'n'){ 
+            gs.day++;  // 天数增加
+            fr.startDay(gs);  // 分店在后台同步营业
+            SceneMain mainScene(gs,r); 
+            mainScene.fr=&fr; 
+            co_await s.push(mainScene.loop(s));  // 运行主场景直到当天结束
+            an.commitDay(mainScene.stats, mainScene.events); 
+            
+            // 等分店跑完当天再结算, 期间照常逐帧刷新
+            fr.finishDay(mainScene.frame); 
+            info=L"分店结算中..."; 
+            while(!fr.done()){ 
+                draw(); 
+                co_await s.frame(); 
+            } 
+            int income=fr.settle(gs); 
+            info = gs.branches.empty() ? L"" : L"分店今日收入 +"+std::to_wstring(income); 
+        } 
+        if(ch==L'U'||ch==L'u'){ 
+            co_await s.push(upgradeMenu(s)); 
+        } 
+        if(ch==L'Q'||ch==L'q'){ 
+            co_return;  // 退出程序
+        } 
+    }
+}
+
+// 操作序列模糊测试 - 无界面地驱动 Shop 的操作与 tickSecond, 每一步后检查不变量;
+// 以(粗粒度状态, 操作, 状态是否改变, 消息类型)的哈希作为覆盖率, 命中新覆盖的序列进入语料库继续变异, 满时随机替换旧用例
+struct Fuzzer {
+    // 测试用例: 随机种子 + 初始金币 + 操作序列
+    struct Case { 
+        unsigned seed=0; 
+        int coins=0; 
+        std::string ops; 
+    };
+    
+    // 操作字母表: 按键; '1'为过一秒; a/g/e 为购买 自动切肉机/金盘子/扩充店面; k 为开分店
+    static constexpr const char* OPS = "BIRGTSFCPMDJ1agek";
+    static constexpr int MAP_BITS = 20;
+    static constexpr size_t MAX_CORPUS = 4096;
+    
+    std::mt19937 rng;                  // 变异用随机数
+    std::vector<uint8_t> coverage;     // 覆盖率位图
+    std::vector<Case> corpus;          // 语料库
+    uint64_t execs=0;                  // 执行用例数
+    uint64_t actions=0;                // 执行操作数
+    int covered=0;                     // 已覆盖特征数
+    
+    explicit Fuzzer(unsigned seed):rng(seed),coverage(1u<<MAP_BITS){}
+    
+    // 各槽位状态, 用于检查状态转移
+    struct Slots { 
+        ShawarmaState open; 
+        ShawarmaState packaged[3]; 
+        ShawarmaState grilling[3]; 
+    };
+    
+    static Slots slots(const Shop& s){ 
+        Slots t; 
+        t.open=s.wraps.stateAt(Place{Station::Board,0}); 
+        for(int i=0;i<3;i++){ 
+            t.packaged[i]=s.wraps.stateAt(Place{Station::Pack,(uint8_t)i}); 
+            t.grilling[i]=s.wraps.stateAt(Place{Station::Grill,(uint8_t)i}); 
+        } 
+        return t; 
+    }
+    
+    // 检查不变量, 返回违反的描述, 全部满足时返回nullptr
+    static const char* check(const Shop& s, const GameState& g, const Slots& prev){ 
+        const Inventory& v=s.inv; 
+        if(v.bread<0 || v.bread>v.breadMax) return "bread out of [0, breadMax]"; 
+        const int items[] = {v.meat,v.sauce,v.cucumber,v.ketchup,v.potato,v.fries,v.cola,v.wrapPaper,v.fryBox,v.colaCup}; 
+        for(int x: items) if(x<0 || x>v.itemMax) return "inventory counter out of [0, itemMax]"; 
+        if(g.coins<0) return "coins negative"; 
+        if((int)g.branches.size()>MAX_BRANCHES) return "branches exceed cap"; 
+        if(s.customers.size()>g.capacity) return "customers exceed capacity"; 
+        if(s.friesPrep.ready && !s.friesPrep.taken) return "fries ready without box"; 
+        if(s.colaPrep.ready && !s.colaPrep.taken) return "cola ready without cup"; 
+        
+        // 实体存储: 组件数组等长, 工位索引与位置组件互相一致
+        const WrapStore& w=s.wraps; 
+        int n=w.size(); 
+        if((int)w.ingredients.size()!=n || (int)w.place.size()!=n || (int)w.timer.size()!=n || (int)w.readyAt.size()!=n) return "wrap component arrays differ in length"; 
+        if(n>WrapStore::MAX) return "too many wraps"; 
+        for(int e=0;e<n;e++) if(w.at(w.place[e])!=e) return "wrap station index out of sync"; 
+        int placed=(w.board>=0); 
+        for(int i=0;i<3;i++) placed += (w.pack[i]>=0) + (w.grill[i]>=0); 
+        if(placed!=n) return "wrap station index has stale entries"; 
+        const CustomerStore& c=s.customers; 
+        if((int)c.patience.size()!=c.size() || (int)c.arrive.size()!=c.size() || (int)c.served.size()!=c.size()) return "customer component arrays differ in length"; 
+        
+        using S=ShawarmaState; 
+        Slots cur=slots(s); 
+        if(cur.open!=S::Empty && cur.open!=S::Open) return "open slot in invalid state"; 
+        for(int i=0;i<3;i++){ 
+            S a=prev.packaged[i], b=cur.packaged[i]; 
+            if(b!=S::Empty && b!=S::Wrapped && b!=S::Done) return "packaged slot in invalid state"; 
+            if(a!=b && a!=S::Empty && b!=S::Empty) return "packaged slot skipped a state"; 
+            
+            a=prev.grilling[i]; b=cur.grilling[i]; 
+            GrillTimer t = w.grill[i]>=0 ? w.timer[w.grill[i]] : GrillTimer(); 
+            if(b!=S::Empty && b!=S::Grilling && b!=S::Done) return "grill slot in invalid state"; 
+            if(a!=b && !((a==S::Empty && b==S::Grilling) || (a==S::Grilling && b==S::Done) || (a==S::Done && b==S::Empty))) return "grill slot illegal transition"; 
+            if(b==S::Grilling && t.time>=t.need) return "grilling past its time"; 
+            if(b==S::Done && t.time<t.need) return "grill done too early"; 
+        } 
+        return nullptr; 
+    }
+    
+    // 执行一个操作
+    static void apply(Shop& s, GameState& g, char op){ 
+        if(op=='1') s.tickSecond(); 
+        else if(op=='a') buyUpgrade(g, Upgrade::AutoMeat); 
+        else if(op=='g') buyUpgrade(g, Upgrade::GoldPlate); 
+        else if(op=='e') buyUpgrade(g, Upgrade::ExpandStore); 
+        else if(op=='k') buyBranch(g); 
+        else s.handleKey((wchar_t)op); 
+    }
+    
+    // 当前状态的粗粒度特征: 工位、顾客与缺货只分几档, 避免每个具体组合都算作新覆盖
+    static uint32_t signature(const Shop& s, const GameState& g){ 
+        Slots t=slots(s); 
+        int packed=0; 
+        bool grilling=false, done=false; 
+        for(int i=0;i<3;i++){ 
+            packed += t.packaged[i]!=ShawarmaState::Empty; 
+            grilling |= t.grilling[i]==ShawarmaState::Grilling; 
+            done |= t.grilling[i]==ShawarmaState::Done; 
+        } 
+        const Inventory& v=s.inv; 
+        bool out = v.bread==0 || v.meat==0 || v.wrapPaper==0 || v.fries==0 || v.potato==0 || v.cola==0 || v.fryBox==0 || v.colaCup==0; 
+        uint32_t h=(uint32_t)t.open; 
+        h = h*3 + (packed==0 ? 0 : packed<3 ? 1 : 2); 
+        h = h*4 + grilling + (done<<1); 
+        h = h*16 + (s.friesPrep.taken) + (s.friesPrep.ready<<1) + (s.colaPrep.taken<<2) + (s.colaPrep.ready<<3); 
+        h = h*3 + (s.customers.empty() ? 0 : s.customers.size()<g.capacity ? 1 : 2); 
+        h = h*8 + g.upAutoMeat + (g.upGoldPlate<<1) + (g.upExpand<<2); 
+        h = h*2 + out; 
+        return h; 
+    }
+    
+    // 运行用例; 失败时返回出错的步号并写出原因, 否则返回-1. newBits不为空时累计新覆盖
+    int run(const Case& c, const char** why, int* newBits){ 
+        GameState g; 
+        g.coins=c.coins; 
+        Shop s(g, c.seed); 
+        Slots prev=slots(s); 
+        uint32_t sig=signature(s,g); 
+        for(int i=0;i<(int)c.ops.size();i++){ 
+            char op=c.ops[i]; 
+            s.msg.clear(); 
+            apply(s, g, op); 
+            actions++; 
+            if(const char* e=check(s, g, prev)){ 
+                if(why) *why=e; 
+                return i; 
+            } 
+            prev=slots(s); 
+            if(newBits){ 
+                // 特征 = (操作前状态, 操作, 状态是否改变, 消息首字); 消息里的金额等数值不参与
+                uint32_t next=signature(s,g); 
+                uint32_t m = s.msg.empty() ? 0 : (uint32_t)s.msg[0]; 
+                uint32_t f = (sig*2654435761u) ^ ((uint32_t)op*97u) ^ ((uint32_t)(next!=sig)*40503u) ^ (m*2246822519u); 
+                f = (f ^ (f>>MAP_BITS)) & ((1u<<MAP_BITS)-1); 
+                if(!coverage[f]){ coverage[f]=1; covered++; (*newBits)++; } 
+                sig=next; 
+            } 
+        } 
+        return -1; 
+    }
+    
+    char randomOp(){ 
+        // 过一秒的操作权重较高, 让烤制与顾客流动起来
+        int k=(int)(rng()%20); 
+        return k<4 ? '1' : OPS[rng()%17]; 
+    }
+    
+    // 生成新用例或变异语料库中的用例
+    Case next(){ 
+        if(corpus.empty() || rng()%8==0){ 
+            Case c; 
+            c.seed=rng(); 
+            c.coins=(int)(rng()%(2*BRANCH_PRICE)); // 覆盖买得起分店的情形
+            int n=16+(int)(rng()%240); 
+            for(int i=0;i<n;i++) c.ops.push_back(randomOp()); 
+            return c; 
+        } 
+        Case c = corpus[rng()%corpus.size()]; 
+        int edits = 1+(int)(rng()%4); 
+        for(int e=0;e<edits;e++){ 
+            size_t n=c.ops.size(); 
+            switch(rng()%6){ 
+                case 0: if(n) c.ops[rng()%n]=randomOp(); break; 
+                case 1: { std::string run; int k=1+(int)(rng()%8); for(int i=0;i<k;i++) run.push_back(randomOp()); c.ops.insert(n?rng()%n:0, run); break; } 
+                case 2: if(n>2){ size_t a=rng()%n, k=1+rng()%std::min<size_t>(n-a,16); c.ops.erase(a,k); } break; 
+                case 3: if(n>2){ size_t a=rng()%n, k=1+rng()%std::min<size_t>(n-a,16); c.ops.insert(rng()%n, c.ops.substr(a,k)); } break; 
+                case 4: { const Case& o=corpus[rng()%corpus.size()]; if(!o.ops.empty() && n) c.ops = c.ops.substr(0,rng()%n) + o.ops.substr(rng()%o.ops.size()); break; } 
+                default: c.seed=rng(); break; 
+            } 
+        } 
+        if(c.ops.size()>2048) c.ops.resize(2048); 
+        return c; 
+    }
+    
+    // 缩减失败用例: 先截断到出错步, 再按块删除仍能复现的部分
+    Case minimize(Case c){ 
+        const char* why=nullptr; 
+        int step=run(c, &why, nullptr); 
+        if(step<0) return c; 
+        c.ops.resize(step+1); 
+        for(size_t chunk=std::max<size_t>(c.ops.size()/2,1); ; chunk/=2){ 
+            for(size_t i=0; i+chunk<=c.ops.size() && c.ops.size()>1; ){ 
+                Case t=c; 
+                t.ops.erase(i,chunk); 
+                if(run(t, &why, nullptr)>=0) c=t; 
+                else i+=chunk; 
+            } 
+            if(chunk==1) break; 
+        } 
+        return c; 
+    }
+    
+    // 在时间预算内持续测试, 发现失败时写出缩减后的用例并返回true
+    bool loop(double seconds, std::atomic<bool>& stop, Case& fail, const char*& why){ 
+        auto end = std::chrono::steady_clock::now() + std::chrono::duration<double>(seconds); 
+        while(!stop.load(std::memory_order_relaxed)){ 
+            for(int k=0;k<256;k++){ 
+                Case c=next(); 
+                int newBits=0; 
+                execs++; 
+                if(run(c, &why, &newBits)>=0){ 
+                    fail=minimize(c); 
+                    run(fail, &why, nullptr); 
+                    stop=true; 
+                    return true; 
+                } 
+                if(!newBits) continue; 
+                if(corpus.size()<MAX_CORPUS) corpus.push_back(std::move(c)); 
+                else corpus[rng()%corpus.size()]=std::move(c);  // 语料库满时随机替换, 新发现不丢弃
+            } 
+            if(std::chrono::steady_clock::now()>=end) break; 
+        } 
+        return false; 
+    }
+    
+    static bool save(const char* path, const Case& c){ 
+        FILE* f=std::fopen(path,"w"); 
+        if(!f) return false; 
+        std::fprintf(f, "%u %d\n%s\n", c.seed, c.coins, c.ops.c_str()); 
+        std::fclose(f); 
+        return true; 
+    }
+    
+    static bool load(const wchar_t* path, Case& c){ 
+        FILE* f=_wfopen(path, L"r"); 
+        if(!f) return false; 
+        char buf[4096]={}; 
+        bool ok = std::fscanf(f, "%u %d %4095s", &c.seed, &c.coins, buf)>=2; 
+        c.ops=buf; 
+        std::fclose(f); 
+        return ok; 
     }
 };
 
+// 模糊测试入口: --fuzz [秒数] [线程数]
+int runFuzz(int argc, wchar_t** argv){ 
+    double seconds = argc>2 ? _wtof(argv[2]) : 10.0; 
+    int threads = argc>3 ? _wtoi(argv[3]) : 1; 
+    threads = std::max(threads, 1); 
+    
+    std::vector<Fuzzer> fuzzers; 
+    for(int i=0;i<threads;i++) fuzzers.emplace_back(clockSeed()+i*7919u); 
+    std::vector<Fuzzer::Case> fails(threads); 
+    std::vector<const char*> whys(threads, nullptr); 
+    std::vector<char> failed(threads, 0); 
+    std::atomic<bool> stop{false}; 
+    
+    auto t0 = std::chrono::steady_clock::now(); 
+    std::vector<std::thread> pool; 
+    for(int i=0;i<threads;i++){ 
+        pool.emplace_back([&,i]{ failed[i]=fuzzers[i].loop(seconds, stop, fails[i], whys[i]); }); 
+    } 
+    for(auto& t: pool) t.join(); 
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now()-t0).count(); 
+    
+    uint64_t execs=0, actions=0; 
+    for(auto& f: fuzzers){ execs+=f.execs; actions+=f.actions; } 
+    std::printf("fuzz: %.1fs, %d thread(s), %llu cases, %llu actions, %.2fM actions/s per core, corpus %zu, coverage %d\n", 
+        secs, threads, (unsigned long long)execs, (unsigned long long)actions, actions/secs/threads/1e6, fuzzers[0].corpus.size(), fuzzers[0].covered); 
+    for(int i=0;i<threads;i++){ 
+        if(!failed[i]) continue; 
+        Fuzzer::save("fuzz_case.txt", fails[i]); 
+        std::printf("FAIL: %s\n  seed %u coins %d ops %s\n  saved to fuzz_case.txt (replay with --replay fuzz_case.txt)\n", 
+            whys[i], fails[i].seed, fails[i].coins, fails[i].ops.c_str()); 
+        return 1; 
+    } 
+    return 0; 
+}
+
+// 重放用例: --replay 文件
+int runReplay(const wchar_t* path){ 
+    Fuzzer::Case c; 
+    if(!Fuzzer::load(path, c)){ 
+        std::printf("cannot read case file\n"); 
+        return 2; 
+    } 
+    Fuzzer fz(0); 
+    const char* why=nullptr; 
+    int step = fz.run(c, &why, nullptr); 
+    if(step<0){ 
+        std::printf("replay: %zu actions, all invariants hold\n", c.ops.size()); 
+        return 0; 
+    } 
+    std::printf("replay: invariant violated at step %d (op '%c'): %s\n", step, c.ops[step], why); 
+    return 1; 
+}
+
+// 解码二进制日志: --decode-log [日志文件]
+int runDecodeLog(int argc, wchar_t** argv){ 
+    FILE* f = argc>2 ? _wfopen(argv[2], L"rb") : std::fopen("shawarma_log.bin","rb"); 
+    if(!f){ 
+        std::printf("cannot open log file\n"); 
+        return 2; 
+    } 
+    std::vector<LogRecord> recs; 
+    LogRecord r; 
+    while(std::fread(&r, sizeof(r), 1, f)==1) recs.push_back(r); 
+    std::fclose(f); 
+    auto isSession=[](const LogRecord& x){ 
+        LogSessionHeader h; 
+        std::memcpy(&h, &x, sizeof(h)); 
+        return h.fmt==Logger::SESSION_FMT && h.magic==Logger::MAGIC && h.ticksPerSec>0; 
+    }; 
+    if(recs.empty() || !isSession(recs[0])){ 
+        std::printf("not a shawarma log\n"); 
+        return 2; 
+    } 
+    
+    // 按会话分段解码; 各线程的记录分批写入, 段内按时间戳合并
+    char line[256]; 
+    int sessions=0; 
+    for(size_t a=0; a<recs.size(); ){ 
+        LogSessionHeader h; 
+        std::memcpy(&h, &recs[a], sizeof(h)); 
+        size_t b=a+1; 
+        while(b<recs.size() && !isSession(recs[b])) b++; 
+        std::stable_sort(recs.begin()+a+1, recs.begin()+b, [](const LogRecord& x, const LogRecord& y){ return x.ts<y.ts; }); 
+        time_t start=(time_t)h.startTime; 
+        char when[32]="?"; 
+        if(const std::tm* tm=std::localtime(&start)) std::strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", tm); 
+        std::printf("== session %d, started %s, %zu records\n", ++sessions, when, b-a-1); 
+        int64_t t0 = b>a+1 ? recs[a+1].ts : 0; 
+        for(size_t i=a+1; i<b; i++){ 
+            const LogRecord& x=recs[i]; 
+            std::snprintf(line, sizeof(line), logFormat(x.fmt), x.args[0], x.args[1], x.args[2], x.args[3], x.args[4]); 
+            std::printf("%12.6f t%u %s\n", (double)(x.ts-t0)/h.ticksPerSec, (unsigned)x.thread, line); 
+        } 
+        a=b; 
+    } 
+    return 0; 
+}
+
+// 日志热路径开销测试: --bench-log [条数]
+// 按半个环形缓冲为一批写入, 批间留时间给后台线程收集, 只统计调用本身的耗时
+int runBenchLog(int argc, wchar_t** argv){ 
+    int n = argc>2 ? _wtoi(argv[2]) : 1000000; 
+    Logger& lg = logger(); 
+    if(!lg.start("bench_log.bin")) return 2; 
+    double ns=0; 
+    for(int done=0; done<n; ){ 
+        int k = std::min<int>(n-done, LogRing::CAP/2); 
+        auto t0 = std::chrono::steady_clock::now(); 
+        for(int i=0;i<k;i++) lg.log(LogFmt::Bench, done+i); 
+        ns += std::chrono::duration<double,std::nano>(std::chrono::steady_clock::now()-t0).count(); 
+        done += k; 
+        std::this_thread::sleep_for(std::chrono::milliseconds(20)); 
+    } 
+    uint64_t dropped = lg.dropped(); 
+    lg.stop(); 
+    std::remove("bench_log.bin"); 
+    std::printf("log: %d calls, %.1f ns/call, %llu dropped (ring full)\n", n, ns/n, (unsigned long long)dropped); 
+    return 0; 
+}
+
+// 不可内联且带屏障的比较: 编译器无法推断其为纯函数, 逐帧比较不会被提到循环外
+static SHAWARMA_NOINLINE int benchCompare(const void* a, const void* b, size_t n){ 
+    SHAWARMA_BARRIER(); 
+    return std::memcmp(a, b, n); 
+}
+
+// 后台缓冲区格式对比: --bench-cells [帧数]
+// 每种尺寸放4层离屏缓冲, 逐帧清屏并与上一帧逐层比较; 旧格式为每格4字节的 CHAR_INFO, 新格式为字符+颜色两个平面(每格3字节)
+int runBenchCells(int argc, wchar_t** argv){ 
+    int frames = argc>2 ? _wtoi(argv[2]) : 2000; 
+    const int LAYERS=4; 
+    const int sizes[][2] = {{100,28},{320,100},{640,240}}; 
+    using clk=std::chrono::steady_clock; 
+    auto nsPerFrame=[&](clk::time_point t0){ return std::chrono::duration<double,std::nano>(clk::now()-t0).count()/frames; }; 
+    int sink=0;  // 累计结果, 防止被优化掉
+    std::printf("%-9s %10s %10s %12s %12s %12s %12s %12s\n", "size", "old KB", "new KB", "old clear", "new clear", "old cmp", "new cmp", "convert"); 
+    for(auto& sz: sizes){ 
+        int n=sz[0]*sz[1], total=n*LAYERS; 
+        
+        // 旧格式
+        std::vector<CHAR_INFO> cells(total), prevCells(total); 
+        CHAR_INFO blank; 
+        blank.Char.UnicodeChar=L' '; 
+        blank.Attributes=FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_RED; 
+        uint32_t blankBits; 
+        std::memcpy(&blankBits, &blank, 4); 
+        auto t0=clk::now(); 
+        for(int f=0;f<frames;f++){ std::fill_n((uint32_t*)cells.data(), total, blankBits); sink+=cells[f%total].Attributes; } 
+        double oldClear=nsPerFrame(t0); 
+        prevCells=cells;  // 比较画面未变的情况, 需扫完整层
+        t0=clk::now(); 
+        for(int f=0;f<frames;f++) for(int l=0;l<LAYERS;l++) sink+=benchCompare(&cells[l*n], &prevCells[l*n], n*sizeof(CHAR_INFO))==0; 
+        double oldCmp=nsPerFrame(t0); 
+        
+        // 新格式
+        std::vector<uint16_t> chars(total), prevChars(total); 
+        std::vector<uint8_t> colors(total), prevColors(total); 
+        uint8_t color=palette().of(blank.Attributes); 
+        t0=clk::now(); 
+        for(int f=0;f<frames;f++){ fillChars(chars.data(), total, L' '); std::memset(colors.data(), color, total); sink+=colors[f%total]; } 
+        double newClear=nsPerFrame(t0); 
+        prevChars=chars; 
+        prevColors=colors; 
+        t0=clk::now(); 
+        for(int f=0;f<frames;f++) for(int l=0;l<LAYERS;l++) 
+            sink+=benchCompare(&chars[l*n], &prevChars[l*n], n*sizeof(uint16_t))==0 && benchCompare(&colors[l*n], &prevColors[l*n], n)==0; 
+        double newCmp=nsPerFrame(t0); 
+        
+        // 呈现时转换一层
+        t0=clk::now(); 
+        for(int f=0;f<frames;f++){ toCharInfo(cells.data(), chars.data(), colors.data(), n, palette()); sink+=cells[f%n].Attributes; } 
+        double convert=nsPerFrame(t0); 
+        
+        char name[16]; 
+        std::snprintf(name, sizeof(name), "%dx%d", sz[0], sz[1]); 
+        std::printf("%-9s %10.1f %10.1f %10.0fns %10.0fns %10.0fns %10.0fns %10.0fns\n", name, 
+            total*sizeof(CHAR_INFO)/1024.0, total*(sizeof(uint16_t)+1)/1024.0, oldClear, newClear, oldCmp, newCmp, convert); 
+    } 
+    std::printf("(%d layers per size, %d frames; KB counts all layers, convert is one layer to CHAR_INFO)\n", LAYERS, frames); 
+    return sink==-1; 
+}
+
 // 主函数
-int wmain(){ 
+// 分店提前收工检查: --check-franchise
+// 玩家在不同帧收工, 分店必须在同一帧打烊, 收入不超过整天, 立刻收工时收不回开店成本
+int runCheckFranchise(){ 
+    GameState g; 
+    g.day=1; 
+    for(int i=0;i<MAX_BRANCHES;i++){ 
+        Branch b; 
+        b.seed=1234567u+(unsigned)i*7919u;  // 固定种子, 各轮模拟相同
+        g.branches.push_back(b); 
+    } 
+    const int fullDay=Shop(g,0).dayTimeMax*FPS; 
+    const int closeAt[]={0, 30*FPS, fullDay}; 
+    int income[3]={}; 
+    int fails=0; 
+    Franchise fr; 
+    for(int k=0;k<3;k++){ 
+        fr.startDay(g); 
+        fr.finishDay(closeAt[k]); 
+        while(!fr.done()) std::this_thread::yield(); 
+        int maxFrame=0; 
+        for(const BranchStats& st: fr.view()) maxFrame=std::max(maxFrame, st.frame); 
+        GameState tally; 
+        income[k]=fr.settle(tally); 
+        // 开始与收工之间墙钟可能已推进几帧
+        bool ok = maxFrame<=std::max(closeAt[k], FPS); 
+        std::printf("close at %5d: branches stopped by frame %5d, income %5d  %s\n", closeAt[k], maxFrame, income[k], ok?"ok":"FAIL"); 
+        fails+=!ok; 
+    } 
+    if(income[0]>=BRANCH_PRICE){ std::printf("FAIL: quitting at once still earns %d (branch costs %d)\n", income[0], BRANCH_PRICE); fails++; } 
+    if(income[1]>income[2]){ std::printf("FAIL: early close earns more than a full day\n"); fails++; } 
+    std::printf(fails ? "franchise: %d check(s) failed\n" : "franchise: all checks passed\n", fails); 
+    return fails ? 1 : 0; 
+}
+
+int wmain(int argc, wchar_t** argv){ 
+    // 命令行工具模式
+    if(argc>1 && std::wstring(argv[1])==L"--fuzz") return runFuzz(argc, argv); 
+    if(argc>2 && std::wstring(argv[1])==L"--replay") return runReplay(argv[2]); 
+    if(argc>1 && std::wstring(argv[1])==L"--decode-log") return runDecodeLog(argc, argv); 
+    if(argc>1 && std::wstring(argv[1])==L"--bench-log") return runBenchLog(argc, argv); 
+    if(argc>1 && std::wstring(argv[1])==L"--bench-cells") return runBenchCells(argc, argv); 
+    if(argc>1 && std::wstring(argv[1])==L"--check-franchise") return runCheckFranchise(); 
+    
     // 初始化渲染器、输入和游戏状态
     Renderer renderer(100,28);  // 100列28行
     Input input; 
     GameState gs; 
+    Analytics analytics; 
+    analytics.aggregate();  // 读取历史事件日志
     
-    // 游戏主循环
-    while(true){ 
-        // 进入入口场景
-        SceneEntrance entr(gs,renderer,input); 
-        entr.loop(); 
-        
-        // 如果选择开始新的一天
-        if(entr.wantStart){ 
-            gs.day++;  // 天数增加
-            SceneMain mainScene(gs,renderer,input); 
-            mainScene.loop();  // 运行主场景
-        } 
-    }
+    // 入口场景为根场景, 退出时场景栈清空, 调度器返回
+    logger().start("shawarma_log.bin");  // 常开日志, 用 --decode-log 查看
+    Scheduler sched(renderer,input); 
+    Franchise franchise; 
+    SceneEntrance entr(gs,renderer,analytics,franchise); 
+    sched.run(entr.loop(sched)); 
+    logger().stop(); 
     return 0; 
 }
\ No newline at end of file